@@ -54,6 +54,7 @@
 #include "llvm/Transforms/Scalar/GVN.h"
 #include "llvm/Transforms/Scalar/Reassociate.h"
 #include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include "llvm/Transforms/Scalar/SROA.h"
 #include "jit/dustjit.h"
 
 
@@ -62,13 +63,28 @@ namespace dust::ast{
     struct Variable{
         std::string name;
         lexer::TokenId typeId;
+        // name of the struct when typeId is IDENT_TK
+        std::string typeName;
     };
     
+    // typeId of a parameter (or return type) left unannotated in a generic fn,
+    // the concrete type is inferred at each call site.
+    inline constexpr lexer::TokenId InferredType = lexer::EOF_TK;
+    
     class ExprAST {
     public:
         virtual ~ExprAST() = default;
         
         virtual llvm::Value *codegen() = 0;
+        
+        // For expressions that name a storage location (variables, struct fields):
+        // emit its address and set Ty to the type stored there. Others return nullptr.
+        virtual llvm::Value *codegenAddress(llvm::Type *&Ty) { return nullptr; }
+        
+        // Emit the expression as a branch condition, an i1. By default a num is
+        // true when it is not 0, comparisons and logical operators override this
+        // to hand their i1 over without converting it to num and back.
+        virtual llvm::Value *codegenCond();
     };
     
     class StmtAST;
@@ -78,6 +94,8 @@ namespace dust::ast{
     public:
         explicit NumberExprAST(double v) : val(v) {}
         
+        [[nodiscard]] double getVal() const { return val; }
+        
         llvm::Value *codegen() override;
     };
     
@@ -87,6 +105,8 @@ namespace dust::ast{
     public:
         explicit StringExprAST( std::string str) : str(std::move(str)){}
         
+        [[nodiscard]] const std::string &getStr() const { return str; }
+        
         llvm::Value* codegen() override;
     };
     
@@ -95,14 +115,26 @@ namespace dust::ast{
         std::string Name;
         std::vector<Variable> Args;
         lexer::TokenId RetType;
+        std::string RetTypeName;
     
     public:
         PrototypeAST(std::string Name, std::vector<Variable> Args,lexer::TokenId
-        Ret=lexer::NUM_TK)
-                : Name(std::move(Name)), Args(std::move(Args)) ,RetType(Ret){}
+        Ret=lexer::NUM_TK, std::string RetName="")
+                : Name(std::move(Name)), Args(std::move(Args)) ,RetType(Ret), RetTypeName(std::move(RetName)){}
         
         [[nodiscard]] std::string const &getName() { return Name; }
         
+        [[nodiscard]] const std::vector<Variable> &getArgs() const { return Args; }
+        
+        [[nodiscard]] lexer::TokenId getRetType() const { return RetType; }
+        
+        [[nodiscard]] const std::string &getRetTypeName() const { return RetTypeName; }
+        
+        // A prototype with any unannotated parameter belongs to a generic fn.
+        [[nodiscard]] bool isGeneric() const {
+            return std::ranges::any_of(Args, [](const Variable &v) { return v.typeId == InferredType; });
+        }
+        
         llvm::Function *codegen() override;
     };
     
@@ -115,6 +147,24 @@ namespace dust::ast{
         [[nodiscard]] const std::string &getName() const { return name; }
         
         llvm::Value *codegen() override;
+        
+        llvm::Value *codegenAddress(llvm::Type *&Ty) override;
+    };
+    
+    
+    // Field access, base.field
+    class MemberExprAST : public ExprAST {
+        std::unique_ptr<ExprAST> base;
+        std::string field;
+    public:
+        MemberExprAST(std::unique_ptr<ExprAST> base, std::string field) :
+                base(std::move(base)), field(std::move(field)) {}
+        
+        [[nodiscard]] ExprAST *getBase() const { return base.get(); }
+        
+        llvm::Value *codegen() override;
+        
+        llvm::Value *codegenAddress(llvm::Type *&Ty) override;
     };
     
     
@@ -125,7 +175,28 @@ namespace dust::ast{
         BinaryExprAST(lexer::Token op, std::unique_ptr<ExprAST> lhs, std::unique_ptr<ExprAST> rhs) :
                 op(std::move(op)), lhs(std::move(lhs)), rhs(std::move(rhs)) {}
         
+        [[nodiscard]] lexer::TokenId getOp() const { return op.tok; }
+        
+        [[nodiscard]] ExprAST *getLHS() const { return lhs.get(); }
+        
+        [[nodiscard]] ExprAST *getRHS() const { return rhs.get(); }
+        
         llvm::Value *codegen() override;
+        
+        llvm::Value *codegenCond() override;
+    };
+    
+    // !operand, 1 if the operand is 0 and 0 otherwise.
+    class NotExprAST : public ExprAST {
+        std::unique_ptr<ExprAST> operand;
+    public:
+        explicit NotExprAST(std::unique_ptr<ExprAST> operand) : operand(std::move(operand)) {}
+        
+        [[nodiscard]] ExprAST *getOperand() const { return operand.get(); }
+        
+        llvm::Value *codegen() override;
+        
+        llvm::Value *codegenCond() override;
     };
     
     
@@ -137,6 +208,12 @@ namespace dust::ast{
                     std::vector<std::unique_ptr<ExprAST>> Args)
                 : callee(std::move(Callee)), args(std::move(Args)) {}
         
+        [[nodiscard]] const std::string &getCallee() const { return callee; }
+        
+        [[nodiscard]] const std::vector<std::unique_ptr<ExprAST>> &getArgs() const { return args; }
+        
+        std::vector<std::unique_ptr<ExprAST>> takeArgs() { return std::move(args); }
+        
         llvm::Value *codegen() override;
     };
     
@@ -151,6 +228,12 @@ namespace dust::ast{
                   std::unique_ptr<ExprAST> Else)
                 : Cond(std::move(Cond)), Then(std::move(Then)), Else(std::move(Else)) {}
         
+        [[nodiscard]] ExprAST *getCond() const { return Cond.get(); }
+        
+        [[nodiscard]] ExprAST *getThen() const { return Then.get(); }
+        
+        [[nodiscard]] ExprAST *getElse() const { return Else.get(); }
+        
         llvm::Value *codegen() override;
     };
     
@@ -11,13 +11,30 @@ namespace dust::ast{
     class FunctionAST : public ExprAST {
         std::unique_ptr<PrototypeAST> Proto;
         std::vector<std::unique_ptr<StmtAST>> Body;
+        
+        // Return types inferred for each instance of a generic fn, by mangled name.
+        std::map<std::string, Variable> InstanceRetTypes;
+        
+        // Emit the body into TheFunction, whose prototype is already created.
+        void codegenBody(llvm::Function *TheFunction);
     
     public:
         FunctionAST(std::unique_ptr<PrototypeAST> Proto,
                     std::vector<std::unique_ptr<StmtAST>> Body)
                 : Proto(std::move(Proto)), Body(std::move(Body)) {}
         
+        [[nodiscard]] PrototypeAST &getProto() const { return *Proto; }
+        
+        [[nodiscard]] const std::vector<std::unique_ptr<StmtAST>> &getBody() const { return Body; }
+        
+        std::vector<std::unique_ptr<StmtAST>> takeBody() { return std::move(Body); }
+        
         llvm::Function *codegen() override;
+        
+        // Specialize a generic fn for the given argument types. Each instance is
+        // emitted once per module with internal linkage, so calls to it can be
+        // inlined, and is named after its signature, e.g. max<num,num>.
+        llvm::Function *instantiate(const std::vector<llvm::Type *> &ArgTypes);
     };
 }
 #endif //DUST_FUNC_H
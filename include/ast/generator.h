@@ -0,0 +1,43 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_GENERATOR_H
+#define DUST_GENERATOR_H
+#include "expr.h"
+#include "stmt.h"
+namespace dust::ast{
+
+    // The generator being emitted. yield stores into its promise and suspends,
+    // return jumps to its final suspend point.
+    struct GeneratorState {
+        llvm::AllocaInst *Promise;
+        llvm::BasicBlock *Cleanup;
+        llvm::BasicBlock *Suspend;
+        llvm::BasicBlock *Final;
+    };
+
+    // gen fn name(args):type { ... yield v; ... }, consumed by for x in name(args).
+    // Lowered to an LLVM switched-resume coroutine. Like generic fns it is emitted
+    // into every module that uses it with internal linkage, so the ramp can be
+    // inlined into the consuming loop and CoroElide can put the frame on its stack.
+    class GeneratorAST {
+        std::unique_ptr<PrototypeAST> Proto;
+        std::vector<std::unique_ptr<StmtAST>> Body;
+
+    public:
+        GeneratorAST(std::unique_ptr<PrototypeAST> Proto,
+                     std::vector<std::unique_ptr<StmtAST>> Body)
+                : Proto(std::move(Proto)), Body(std::move(Body)) {}
+
+        [[nodiscard]] PrototypeAST &getProto() const { return *Proto; }
+
+        // The type of the values it yields.
+        llvm::Type *getYieldType() const;
+
+        // Get the ramp function in the current module, emitting it on first use.
+        // It runs the body up to the first yield and returns the coroutine handle.
+        llvm::Function *codegen();
+    };
+}
+#endif //DUST_GENERATOR_H
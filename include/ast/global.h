@@ -0,0 +1,45 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_GLOBAL_H
+#define DUST_GLOBAL_H
+#include "expr.h"
+namespace dust::ast{
+
+    // A top-level `var` or `const` declaration. The definition lives in the
+    // JIT's globals dylib, every other module only references it.
+    class GlobalVarAST {
+        Variable Var;
+        bool IsConst;
+        std::unique_ptr<ExprAST> Init;
+
+    public:
+        GlobalVarAST(Variable Var, bool IsConst, std::unique_ptr<ExprAST> Init)
+                : Var(std::move(Var)), IsConst(IsConst), Init(std::move(Init)) {}
+
+        [[nodiscard]] const std::string &getName() const { return Var.name; }
+
+        [[nodiscard]] const Variable &getVar() const { return Var; }
+
+        // The initializer, nullptr if there is none.
+        [[nodiscard]] ExprAST *getInit() const { return Init.get(); }
+
+        [[nodiscard]] bool isConst() const { return IsConst; }
+
+        [[nodiscard]] bool hasInit() const { return Init != nullptr; }
+
+        // True if the initial value is known at compile time (a number or string literal).
+        [[nodiscard]] bool hasLiteralInit() const;
+
+        // Emit the definition into the current module.
+        llvm::GlobalVariable *codegen();
+
+        // Emit a reference to the global into the current module.
+        llvm::GlobalVariable *codegenDecl();
+
+        // Emit an __anon_expr that stores a non-literal initializer into the global.
+        llvm::Function *codegenInit();
+    };
+}
+#endif //DUST_GLOBAL_H
@@ -84,6 +84,50 @@ namespace dust::ast{
         
         void codegen() override;
     };
+    
+    // match over an integer-valued expression, lowered to a switch instruction.
+    class MatchStmtAST : public StmtAST {
+    public:
+        struct Case {
+            std::vector<int64_t> Labels;
+            std::vector<std::unique_ptr<StmtAST>> Body;
+        };
+        
+        MatchStmtAST(std::unique_ptr<ExprAST> Val, std::vector<Case> Cases,
+                     std::vector<std::unique_ptr<StmtAST>> Default) : Val(std::move(Val)), Cases(std::move(Cases)),
+                                                                      Default(std::move(Default)) {}
+        
+        std::unique_ptr<ExprAST> Val;
+        std::vector<Case> Cases;
+        std::vector<std::unique_ptr<StmtAST>> Default;
+        
+        void codegen() override;
+    };
+    
+    // yield Val; inside a gen fn: hand Val to the consumer and suspend until resumed.
+    class YieldStmtAST : public StmtAST {
+    public:
+        explicit YieldStmtAST(std::unique_ptr<ExprAST> Val) : Val(std::move(Val)) {}
+        
+        std::unique_ptr<ExprAST> Val;
+        
+        void codegen() override;
+    };
+    
+    // for x in gen(args) { ... }, runs the body once for every value the generator yields.
+    class ForInStmtAST : public StmtAST {
+    public:
+        ForInStmtAST(std::string VarName, std::string Gen, std::vector<std::unique_ptr<ExprAST>> Args,
+                     std::vector<std::unique_ptr<StmtAST>> Body) : VarName(std::move(VarName)), Gen(std::move(Gen)),
+                                                                   Args(std::move(Args)), Body(std::move(Body)) {}
+        
+        std::string VarName;
+        std::string Gen;
+        std::vector<std::unique_ptr<ExprAST>> Args;
+        std::vector<std::unique_ptr<StmtAST>> Body;
+        
+        void codegen() override;
+    };
 
     
 
@@ -0,0 +1,30 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_STRUCT_H
+#define DUST_STRUCT_H
+#include "expr.h"
+namespace dust::ast{
+
+    // struct Name { field:type, ... }, a record of fields held by value.
+    class StructAST {
+        std::string Name;
+        std::vector<Variable> Fields;
+
+    public:
+        StructAST(std::string Name, std::vector<Variable> Fields)
+                : Name(std::move(Name)), Fields(std::move(Fields)) {}
+
+        [[nodiscard]] const std::string &getName() const { return Name; }
+
+        [[nodiscard]] const std::vector<Variable> &getFields() const { return Fields; }
+
+        // Position of Field in the struct, or -1 if there is no such field.
+        [[nodiscard]] int getFieldIndex(const std::string &Field) const;
+
+        // Get the named struct type in the current context, creating it on first use.
+        llvm::StructType *codegen();
+    };
+}
+#endif //DUST_STRUCT_H
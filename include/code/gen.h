@@ -5,4 +5,15 @@
 #ifndef DUST_GEN_H
 #define DUST_GEN_H
 
+namespace dust::code{
+    // Compile the whole source file (already lexed) ahead of time into one
+    // module and write it out as asked by Opts: an object file, a shared library
+    // or an executable, each linked against the runtime in lib/print.cc.
+    // Objects and shared libraries come with a C header declaring their
+    // functions and <name>_init, which runs the top-level statements and the
+    // initializers of the globals. A snapshot (see snapshot.h) is compiled for
+    // this machine and the JIT instead. Returns the exit code.
+    int CompileProgram();
+}
+
 #endif //DUST_GEN_H
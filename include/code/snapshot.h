@@ -0,0 +1,49 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_SNAPSHOT_H
+#define DUST_SNAPSHOT_H
+
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dust::code{
+    // [begin, end) in lexer::tokens
+    using TokenRange = std::pair<size_t, size_t>;
+
+    // Version of the image format, bumped whenever it changes.
+    inline constexpr unsigned ImageVersion = 3;
+
+    // The dust binary running, by its path, size and modification time. Images
+    // compiled by another build of it may hold other code.
+    std::string CompilerId();
+
+    // Runs the top-level statements of a snapshot.
+    inline constexpr llvm::StringLiteral SnapshotInit = "__dust_snapshot_init";
+
+    // Write the image of a session compiled by CompileProgram: the declarations
+    // the parser knows about (structs, fn prototypes, globals), the tokens of the
+    // Templates (generic fns and generators, compiled per call site) and Obj,
+    // the native code of everything else.
+    bool WriteSnapshot(const std::string &Path, llvm::StringRef Obj, const std::vector<TokenRange> &Templates);
+
+    // Restore the session saved in the image at Path into the JIT, without
+    // parsing or compiling any of it again, and run its top-level statements.
+    bool LoadSnapshot(const std::string &Path);
+
+    // The same for the image of an imported unit (see unit.h), into a dylib of
+    // its own after the units it imports. Each unit is loaded once per JIT.
+    bool LoadUnit(const std::string &Path);
+
+    // Only declare what the unit image at Path holds, for the session being
+    // compiled, whose snapshot then imports it.
+    bool DeclareUnit(const std::string &Path);
+
+    // Forget the units declared so far.
+    void ClearImports();
+}
+
+#endif //DUST_SNAPSHOT_H
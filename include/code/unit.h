@@ -0,0 +1,39 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_UNIT_H
+#define DUST_UNIT_H
+
+#include <string>
+#include <vector>
+
+// Units: `import "lib.ds";` brings in the fns, globals and structs of lib.ds,
+// a path relative to the importing file.
+//
+// Each unit is compiled apart, on a thread with an engine of its own, into a
+// snapshot image (see snapshot.h) whose table is its interface. The image is
+// named after the hash of the unit's source, the target, the image format,
+// the dust binary, the importer's options that change the code (--tiered,
+// --profile-use) and the units it imports, in <cache dir>/units or the temp
+// directory, so importers share it within the process and across runs. In the JIT each
+// unit gets a dylib of its own. A fn may only be defined by one of the units
+// a session imports.
+namespace dust::code{
+    // The path of the unit File, imported by the file being parsed.
+    std::string ResolveImport(const std::string &File);
+
+    // Start compiling the units imported from lexer::tokens, they build in
+    // parallel while the file is parsed up to its imports.
+    void PrefetchImports();
+
+    // The image of the unit at Path, compiled if need be. Empty (after
+    // printing the problem) if it or a unit it imports does not compile.
+    std::string UnitImage(const std::string &Path);
+
+    // The images of the units Source, the file File, imports, compiled if
+    // need be. An empty one for a unit that does not compile.
+    std::vector<std::string> ImportedImages(const std::string &Source, const std::string &File);
+}
+
+#endif //DUST_UNIT_H
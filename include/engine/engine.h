@@ -0,0 +1,123 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_ENGINE_H
+#define DUST_ENGINE_H
+
+#include "lexer/lexer.h"
+#include "utils/options.h"
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace dust{
+    // The dust type a host type passes as, only num and str cross over.
+    template <typename T>
+    struct HostType;
+
+    template <>
+    struct HostType<double> {
+        static constexpr lexer::TokenId Id = lexer::NUM_TK;
+    };
+
+    template <>
+    struct HostType<const char *> {
+        static constexpr lexer::TokenId Id = lexer::STR_TK;
+    };
+
+    template <typename Sig>
+    struct HostSignature;
+
+    template <typename Ret, typename... Args>
+    struct HostSignature<Ret(Args...)> {
+        static constexpr lexer::TokenId RetId = HostType<Ret>::Id;
+        static constexpr std::array<lexer::TokenId, sizeof...(Args)> ArgIds{HostType<Args>::Id...};
+    };
+
+    // A fn of nums over Rows rows: Columns holds an array per parameter, the
+    // result of row i goes to Out[i]. Out must not overlap a column.
+    using BatchFn = void (*)(const double *const *Columns, double *Out, uint64_t Rows);
+
+    // dust embedded in a host program: compile sources into the JIT and call
+    // their fns through plain function pointers.
+    //
+    //   auto E = dust::Engine::Create();
+    //   E->compile("fn calc(a:num,b:num):num{ return a*b+1; }");
+    //   auto *Calc = E->get<double(double, double)>("calc");
+    //   double R = Calc(2, 3);
+    //
+    // The compiler keeps its state per thread: there is one engine per thread,
+    // used only from the thread that created it, and engines on different
+    // threads share nothing but the process. With Opts.Workers the engine
+    // runs its scripts in a worker process of its own (see LaunchWorker), and
+    // define, get and batch are not available.
+    class Engine {
+        struct Symbol {
+            void *Addr;
+            lexer::TokenId Ret;
+            std::vector<lexer::TokenId> Args;
+        };
+
+        // Looked up once per fn, the stub's address stays valid across redefinitions.
+        std::map<std::string, Symbol> Symbols;
+
+        // The batch made of each fn, with the definition it was made from.
+        std::map<std::string, std::pair<unsigned, BatchFn>> Batches;
+
+        Engine() = default;
+
+        void *address(const std::string &Name, lexer::TokenId Ret, std::span<const lexer::TokenId> Args);
+
+    public:
+        // Set up the JIT as the command line would with O, nullptr (after
+        // printing the problem) if it can not be or this thread has an engine.
+        static std::unique_ptr<Engine> Create(const Options &O);
+
+        // The defaults of the command line, without echoing what is read.
+        static std::unique_ptr<Engine> Create();
+
+        Engine(const Engine &) = delete;
+
+        Engine &operator=(const Engine &) = delete;
+
+        // Frees the JIT'd code and everything compiled, pointers from get are
+        // dangling after. The thread can create a new engine then.
+        ~Engine();
+
+        // Compile Source like a script file: definitions stay, top-level
+        // statements run right away. Errors are logged and the item skipped,
+        // false if there were any.
+        bool compile(const std::string &Source);
+
+        // Make Fn callable from scripts that declare it extern as Name.
+        bool define(const std::string &Name, void *Fn);
+
+        // The fn Name as a native function pointer, e.g.
+        // get<double(double, const char *)>("f"). nullptr if there is no such
+        // fn or its signature differs. Calls go straight to the JIT'd code,
+        // through the stub that follows redefinitions.
+        template <typename Sig>
+        Sig *get(const std::string &Name) {
+            using S = HostSignature<Sig>;
+            return reinterpret_cast<Sig *>(address(Name, S::RetId, S::ArgIds));
+        }
+
+        // The fn Name run over whole columns in one call, with its body inlined
+        // into a loop the optimizer vectorizes, so rows cost no call each:
+        //
+        //   const double *Cols[] = {Prices.data(), Qtys.data()};
+        //   E->batch("score")(Cols, Scores.data(), Rows);
+        //
+        // Only for fns taking and returning nums, compiled with Opts.Batch
+        // (the default of Create()). It runs the definition current when it
+        // was made, a redefinition gets a new batch on the next call.
+        BatchFn batch(const std::string &Name);
+    };
+}
+
+#endif //DUST_ENGINE_H
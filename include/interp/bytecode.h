@@ -0,0 +1,126 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_BYTECODE_H
+#define DUST_BYTECODE_H
+
+#include "ast/func.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dust::interp{
+
+    // One register. Every value the interpreter runs (num and str) fits in it,
+    // structs are left to the JIT.
+    union Slot {
+        double Num;
+        const char *Str;
+    };
+
+    enum class Kind : uint8_t {
+        Num,
+        Str
+    };
+
+    // Register operands are A, B and C. Comparisons are unordered like the
+    // fcmps the JIT emits, conditions test a num the way codegenCond does.
+    #define DUST_OPCODES(f) \
+    f(LoadK)            /* A = K[B] */ \
+    f(Move)             /* A = B */ \
+    f(LoadGlobal)       /* A = *G[B] */ \
+    f(StoreGlobal)      /* *G[B] = A */ \
+    f(Add)              /* A = B + C, and so on */ \
+    f(Sub) \
+    f(Mul) \
+    f(Div) \
+    f(Lt)               /* A = B < C ? 1 : 0, and so on */ \
+    f(Le) \
+    f(Gt) \
+    f(Ge) \
+    f(Eq) \
+    f(Ne) \
+    f(Truth)            /* A = B is true ? 1 : 0 */ \
+    f(Not)              /* A = B is true ? 0 : 1 */ \
+    f(Jump)             /* goto B */ \
+    f(Loop)             /* goto B, a back-edge, counted towards promotion */ \
+    f(JumpIfFalse)      /* if A is false goto B */ \
+    f(JumpIfTrue)       /* if A is true goto B */ \
+    f(JumpIfEqK)        /* if A == K[C] goto B */ \
+    f(Call)             /* A = call site B with the args from register C on */ \
+    f(Ret)              /* return A */
+
+    enum class Opcode : uint8_t {
+#define DUST_OPCODE(name) name,
+        DUST_OPCODES(DUST_OPCODE)
+#undef DUST_OPCODE
+    };
+
+    struct Insn {
+        Opcode Op;
+        uint32_t A, B, C;
+    };
+
+    // Calls native code of one signature with the args in Slots.
+    using NativeThunk = Slot (*)(void *Fn, const Slot *Args);
+
+    // Natives with more args are not called from bytecode.
+    inline constexpr size_t MaxNativeArgs = 6;
+
+    // The thunk for a signature, nullptr if it has more than MaxNativeArgs args.
+    NativeThunk GetThunk(const std::vector<Kind> &Args, Kind Ret);
+
+    struct Function;
+
+    // What a fn name called from bytecode currently is: bytecode, or native
+    // code behind its stub (a JIT'd or promoted fn, or an extern).
+    struct Entry {
+        std::string Name;
+        std::unique_ptr<Function> Fn;
+        // looked up on the first native call
+        void *Addr = nullptr;
+    };
+
+    // The Entry of Name, created on first use. Entries never move.
+    Entry &GetEntry(const std::string &Name);
+
+    // The native address of E, looked up in the JIT. nullptr if it is not
+    // there (an extern nothing defines), which is logged.
+    void *NativeAddress(Entry &E);
+
+    struct CallSite {
+        Entry *Callee;
+        // used once the callee is native
+        NativeThunk Thunk;
+    };
+
+    struct Function {
+        std::string Name;
+        uint32_t NumArgs = 0;
+        uint32_t NumRegs = 0;
+        std::vector<Insn> Code;
+        std::vector<Slot> Consts;
+        std::vector<Slot *> Globals;
+        std::vector<CallSite> Calls;
+        bool HasLoops = false;
+        // calls plus loop iterations, the fn is compiled at Opts.TierThreshold
+        uint64_t Hits = 0;
+        // what is compiled, null for top-level statements and once promoted
+        std::unique_ptr<ast::FunctionAST> AST;
+    };
+
+    // Translate Fn to bytecode, nullptr if it uses what only the JIT runs
+    // (structs, generators, generic fns, calls with too many args) or may end
+    // without a return, which the JIT reports.
+    std::unique_ptr<Function> Compile(ast::FunctionAST &Fn);
+
+    // Run F on Args, which are copied into its frame.
+    Slot Run(Function &F, const Slot *Args);
+
+    // Hand F over to the JIT, later calls go to the compiled code.
+    void Promote(Function &F);
+}
+
+#endif //DUST_BYTECODE_H
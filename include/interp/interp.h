@@ -0,0 +1,31 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_INTERP_H
+#define DUST_INTERP_H
+
+#include "ast/func.h"
+#include <memory>
+#include <string>
+
+// --interp: fns and top-level statements run as bytecode right away, without
+// going through LLVM. A fn is compiled by the JIT once it is hot, until then
+// JIT'd code reaches it through a trampoline behind its stub.
+namespace dust::interp{
+    // Make Fn the definition of its name, run by the interpreter. Takes Fn, or
+    // leaves it and returns false if only the JIT can run it.
+    bool DefineFunction(std::unique_ptr<ast::FunctionAST> &Fn);
+
+    // Run the __anon_expr Fn, false if it is left to the JIT: it can not be
+    // interpreted, or it loops and would be stuck in the interpreter.
+    bool RunTopLevel(ast::FunctionAST &Fn);
+
+    // Name was compiled by the JIT, bytecode calls go there from now on.
+    void ForgetFunction(const std::string &Name);
+
+    // Drop all bytecode, once the trampolines leading to it are freed.
+    void Clear();
+}
+
+#endif //DUST_INTERP_H
@@ -5,67 +5,195 @@
 #ifndef DUST_DUSTJIT_H
 #define DUST_DUSTJIT_H
 
+#include "llvm/ADT/FunctionExtras.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/EPCIndirectionUtils.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/ExecutionEngine/Orc/EPCDynamicLibrarySearchGenerator.h"
+#include "llvm/ExecutionEngine/Orc/EPCEHFrameRegistrar.h"
 #include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/MapperJITLinkMemoryManager.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/Shared/ExecutorSymbolDef.h"
+#include "llvm/ExecutionEngine/Orc/TaskDispatch.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
+#include "jit/objcache.h"
+#include "jit/slabmm.h"
+#include <map>
 #include <memory>
+#include <mutex>
 
 
 using namespace llvm::orc;
 
+// Defines the name of a fn as its stub. Materializing it (on the first lookup)
+// compiles the fn's body and creates the stub pointing there, see DustJIT::defineFunction.
+class StubMaterializationUnit : public MaterializationUnit {
+public:
+    using MaterializeFn = llvm::unique_function<void(std::unique_ptr<MaterializationResponsibility>)>;
+
+private:
+    MaterializeFn Materialize;
+
+public:
+    StubMaterializationUnit(SymbolStringPtr Name, MaterializeFn Materialize)
+            : MaterializationUnit(Interface(
+                    SymbolFlagsMap{{std::move(Name), llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable}},
+                    nullptr)),
+              Materialize(std::move(Materialize)) {}
+    
+    llvm::StringRef getName() const override { return "<stub>"; }
+    
+    void materialize(std::unique_ptr<MaterializationResponsibility> R) override { Materialize(std::move(R)); }
+
+private:
+    void discard(const JITDylib &, const SymbolStringPtr &) override {}
+};
+
 class DustJIT {
 
 
 private:
     std::unique_ptr<llvm::orc::ExecutionSession> ES;
+    // Set in lazy mode, for the stubs and the lazy call-through, and when
+    // running in a worker, for the stubs there.
+    std::unique_ptr<EPCIndirectionUtils> EPCIU;
     
     llvm::DataLayout DL;
     MangleAndInterner Mangle;
+    JITTargetMachineBuilder JTMB;
+    // Only set with a cache directory, consulted by the compiler.
+    std::unique_ptr<ObjectFileCache> Cache;
     
-    RTDyldObjectLinkingLayer ObjectLayer;
+    std::shared_ptr<JITMemoryStats> MemStats;
+    // RuntimeDyld over the slab allocator, or JITLink.
+    std::unique_ptr<ObjectLayer> ObjLayer;
     IRCompileLayer CompileLayer;
+    IRTransformLayer OptimizeLayer;
+    // Only set in lazy mode, sits on top of OptimizeLayer.
+    std::unique_ptr<CompileOnDemandLayer> CODLayer;
+    // Not set in lazy mode. Every call of a fn goes through its stub, so a new
+    // body (a redefinition or a tier-up) can be swapped in under its callers.
+    std::unique_ptr<IndirectStubsManager> Stubs;
+    
+    // Per fn behind a stub: the body the stub points at and the tracker of its
+    // module, null for a body from addObjectFile, and the tracker of the stub
+    // symbol itself. Held while a body is replaced.
+    struct StubTarget {
+        std::string Impl;
+        ResourceTrackerSP RT;
+        ResourceTrackerSP StubRT;
+    };
+    std::mutex StubsMutex;
+    std::map<std::string, StubTarget> StubTargets;
+    // Replaced bodies, freed by reclaim once none of them can be running.
+    std::vector<ResourceTrackerSP> Retired;
+    // Names defined by addHostFunction.
+    llvm::StringSet<> HostFunctions;
+    // The files objects from addObjectFile were linked out of.
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> Images;
+    // The dylibs of imported units (see addUnit) in the order they came, and by name.
+    std::vector<JITDylib *> Units;
+    std::map<std::string, JITDylib *> UnitsByName;
+    
+    bool HasOptimizer = false;
+    // JIT'd code runs in a worker process (see LaunchWorker), not in this one.
+    bool Remote = false;
     
     JITDylib &MainJD;
+    // Module-level globals are defined here, MainJD links against it.
+    JITDylib &GlobalsJD;
+    
+    static void handleLazyCallThroughError() {
+        llvm::errs() << "LazyCallThrough error: Could not find function body";
+        exit(1);
+    }
 
 public:
-    DustJIT(std::unique_ptr<ExecutionSession> ES,
-            JITTargetMachineBuilder JTMB, llvm::DataLayout DL)
-            : ES(std::move(ES)), DL(DL), Mangle(*this->ES, this->DL),
-              ObjectLayer(*this->ES,
-                          []() { return std::make_unique<llvm::SectionMemoryManager>(); }),
-              CompileLayer(*this->ES, ObjectLayer,
-                           std::make_unique<ConcurrentIRCompiler>(std::move(JTMB))),
-              MainJD(this->ES->createBareJITDylib("<main>")) {
-        MainJD.addGenerator(
-                cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(
-                        DL.getGlobalPrefix())));
-        if (JTMB.getTargetTriple().isOSBinFormatCOFF()) {
-            ObjectLayer.setOverrideObjectFlagsWithResponsibilityFlags(true);
-            ObjectLayer.setAutoClaimResponsibilityForObjectSymbols(true);
+    DustJIT(std::unique_ptr<ExecutionSession> ES, std::unique_ptr<EPCIndirectionUtils> EPCIU,
+            JITTargetMachineBuilder JTMB, llvm::DataLayout DL, std::unique_ptr<ObjectFileCache> Cache,
+            std::shared_ptr<JITMemoryStats> MemStats, std::unique_ptr<ObjectLayer> ObjLayer,
+            std::unique_ptr<IndirectStubsManager> Stubs)
+            : ES(std::move(ES)), EPCIU(std::move(EPCIU)), DL(DL), Mangle(*this->ES, this->DL),
+              JTMB(std::move(JTMB)), Cache(std::move(Cache)),
+              MemStats(std::move(MemStats)), ObjLayer(std::move(ObjLayer)),
+              CompileLayer(*this->ES, *this->ObjLayer,
+                           std::make_unique<ConcurrentIRCompiler>(this->JTMB, this->Cache.get())),
+              OptimizeLayer(*this->ES, CompileLayer), Stubs(std::move(Stubs)),
+              MainJD(this->ES->createBareJITDylib("<main>")),
+              GlobalsJD(this->ES->createBareJITDylib("<globals>")) {
+        if (!this->Stubs) {
+            // Each function is split into its own module on first call, only
+            // then optimized and compiled. Until then callers go through a stub.
+            CODLayer = std::make_unique<CompileOnDemandLayer>(
+                    *this->ES, OptimizeLayer, this->EPCIU->getLazyCallThroughManager(),
+                    [this] { return this->EPCIU->createIndirectStubsManager(); });
         }
+        MainJD.addToLinkOrder(GlobalsJD);
     }
     
     ~DustJIT() {
         if (auto Err = ES->endSession())
             ES->reportError(std::move(Err));
+        if (EPCIU)
+            if (auto Err = EPCIU->cleanup())
+                ES->reportError(std::move(Err));
     }
     
-    static std::unique_ptr<DustJIT> Create() {
-        auto EPC = SelfExecutorProcessControl::Create();
-        if (!EPC)
-            return nullptr;
+    // CacheDir enables the object cache, holding up to CacheSize bytes. JITLink
+    // selects the ObjectLinkingLayer over RuntimeDyld, HugePages backs the code
+    // slabs of RuntimeDyld by huge pages. With Worker, code is linked by JITLink
+    // into the worker's memory and runs there, not in lazy mode. InPlace runs
+    // materialization on the thread asking for it, the JIT starts no threads.
+    static std::unique_ptr<DustJIT> Create(bool Lazy = false, const std::string &CacheDir = "",
+                                           uint64_t CacheSize = 0, bool JITLink = false, bool HugePages = false,
+                                           std::unique_ptr<ExecutorProcessControl> Worker = nullptr,
+                                           bool InPlace = false) {
+        bool Remote = Worker != nullptr;
+        std::unique_ptr<ExecutorProcessControl> EPC = std::move(Worker);
+        if (!EPC) {
+            // Materialization (optimizing in lazy mode, compiling, linking) is
+            // dispatched to a thread pool, so independent modules build in parallel.
+            std::unique_ptr<TaskDispatcher> Dispatcher;
+            if (InPlace)
+                Dispatcher = std::make_unique<InPlaceTaskDispatcher>();
+            else
+                Dispatcher = std::make_unique<DynamicThreadPoolTaskDispatcher>();
+            auto Self = SelfExecutorProcessControl::Create(nullptr, std::move(Dispatcher));
+            if (!Self)
+                return nullptr;
+            EPC = std::move(*Self);
+        }
         
-        auto ES = std::make_unique<ExecutionSession>(std::move(*EPC));
+        auto ES = std::make_unique<ExecutionSession>(std::move(EPC));
+        
+        std::unique_ptr<EPCIndirectionUtils> EPCIU;
+        if (Lazy) {
+            auto EPCIUOrErr = EPCIndirectionUtils::Create(ES->getExecutorProcessControl());
+            if (!EPCIUOrErr) {
+                ES->reportError(EPCIUOrErr.takeError());
+                return nullptr;
+            }
+            EPCIU = std::move(*EPCIUOrErr);
+            EPCIU->createLazyCallThroughManager(
+                    *ES, ExecutorAddr::fromPtr(&handleLazyCallThroughError));
+            if (auto Err = setUpInProcessLCTMReentryViaEPCIU(*EPCIU)) {
+                ES->reportError(std::move(Err));
+                return nullptr;
+            }
+        }
         
         JITTargetMachineBuilder JTMB(
                 ES->getExecutorProcessControl().getTargetTriple());
@@ -74,22 +202,370 @@ public:
         if (!DL)
             return nullptr;
         
-        return std::make_unique<DustJIT>(std::move(ES), std::move(JTMB),
-                                         std::move(*DL));
+        std::unique_ptr<ObjectFileCache> Cache;
+        if (!CacheDir.empty()) {
+            // Objects are only valid for the target they were compiled for. The
+            // codegen level is always the JTMB default, so it needs no entry.
+            Cache = std::make_unique<ObjectFileCache>(CacheDir, CacheSize, targetId(JTMB));
+        }
+        
+        // Many small objects share the memory of few large mappings.
+        auto MemStats = std::make_shared<JITMemoryStats>();
+        std::unique_ptr<ObjectLayer> ObjLayer;
+        if (Remote) {
+            // The worker allocates the memory, the stats stay empty.
+            auto Layer = std::make_unique<ObjectLinkingLayer>(*ES);
+            if (auto Registrar = EPCEHFrameRegistrar::Create(*ES))
+                Layer->addPlugin(std::make_unique<EHFrameRegistrationPlugin>(*ES, std::move(*Registrar)));
+            else
+                ES->reportError(Registrar.takeError());
+            ObjLayer = std::move(Layer);
+        } else if (JITLink) {
+            auto MemMgr = MapperJITLinkMemoryManager::CreateWithMapper<CountingMemoryMapper>(64 << 20, MemStats);
+            if (!MemMgr) {
+                ES->reportError(MemMgr.takeError());
+                return nullptr;
+            }
+            auto Layer = std::make_unique<ObjectLinkingLayer>(*ES, std::move(*MemMgr));
+            if (auto Registrar = EPCEHFrameRegistrar::Create(*ES))
+                Layer->addPlugin(std::make_unique<EHFrameRegistrationPlugin>(*ES, std::move(*Registrar)));
+            else
+                ES->reportError(Registrar.takeError());
+            ObjLayer = std::move(Layer);
+        } else {
+            auto Slabs = std::make_shared<SlabAllocator>(MemStats, HugePages);
+            std::unique_ptr<RTDyldObjectLinkingLayer> Layer;
+            if (Slabs->mapsCode())
+                Layer = std::make_unique<RTDyldObjectLinkingLayer>(
+                        *ES, [Slabs]() { return std::make_unique<SlabMemoryManager>(Slabs); });
+            else // Pages of its own per object, executable once written.
+                Layer = std::make_unique<RTDyldObjectLinkingLayer>(
+                        *ES, []() { return std::make_unique<llvm::SectionMemoryManager>(); });
+            if (JTMB.getTargetTriple().isOSBinFormatCOFF()) {
+                Layer->setOverrideObjectFlagsWithResponsibilityFlags(true);
+                Layer->setAutoClaimResponsibilityForObjectSymbols(true);
+            }
+            ObjLayer = std::move(Layer);
+        }
+        
+        // Lazy mode already calls through the stubs of the CODLayer.
+        std::unique_ptr<IndirectStubsManager> Stubs;
+        if (Remote) {
+            // The stubs must be in the worker along with the code calling them.
+            auto EPCIUOrErr = EPCIndirectionUtils::Create(ES->getExecutorProcessControl());
+            if (!EPCIUOrErr) {
+                ES->reportError(EPCIUOrErr.takeError());
+                return nullptr;
+            }
+            EPCIU = std::move(*EPCIUOrErr);
+            Stubs = EPCIU->createIndirectStubsManager();
+        } else if (!Lazy) {
+            auto ISMBuilder = createLocalIndirectStubsManagerBuilder(JTMB.getTargetTriple());
+            if (!ISMBuilder)
+                return nullptr;
+            Stubs = ISMBuilder();
+        }
+        
+        auto J = std::make_unique<DustJIT>(std::move(ES), std::move(EPCIU), std::move(JTMB),
+                                           std::move(*DL), std::move(Cache), std::move(MemStats),
+                                           std::move(ObjLayer), std::move(Stubs));
+        J->Remote = Remote;
+        if (auto Err = J->addRuntimeGenerator(J->MainJD)) {
+            J->ES->reportError(std::move(Err));
+            return nullptr;
+        }
+        return J;
+    }
+    
+    bool isLazy() const { return CODLayer != nullptr; }
+    
+    // Whether JIT'd code runs in a worker, its addresses are not pointers here.
+    bool isRemote() const { return Remote; }
+    
+    // Whether fns can be defined again, not in lazy mode.
+    bool hasStubs() const { return Stubs != nullptr; }
+    
+    ObjectFileCache *getObjectCache() { return Cache.get(); }
+    
+    // With an optimizer, modules are handed over unoptimized and Optimize runs
+    // right before they are compiled: in lazy mode on each function when it is
+    // first called, with the object cache only on a cache miss.
+    void setOptimizer(IRTransformLayer::TransformFunction Optimize) {
+        OptimizeLayer.setTransform(std::move(Optimize));
+        HasOptimizer = true;
     }
     
+    bool optimizesModules() const { return HasOptimizer; }
+    
     const llvm::DataLayout &getDataLayout() const { return DL; }
     
+    const JITMemoryStats &getMemoryStats() const { return *MemStats; }
+    
+    // Triple, CPU and features the JIT compiles for, as one word.
+    static std::string targetId(const JITTargetMachineBuilder &JTMB) {
+        return JTMB.getTargetTriple().str() + "|" + JTMB.getCPU() + "|" + JTMB.getFeatures().getString();
+    }
+    
+    std::string getTargetId() const { return targetId(JTMB); }
+    
+    // A target machine matching the JIT's, for optimizations that consult the target.
+    llvm::Expected<std::unique_ptr<llvm::TargetMachine>> createTargetMachine() {
+        return JTMB.createTargetMachine();
+    }
+    
     JITDylib &getMainJITDylib() { return MainJD; }
     
     llvm::Error addModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr) {
         if (!RT)
             RT = MainJD.getDefaultResourceTracker();
-        return CompileLayer.add(RT, std::move(TSM));
+        if (CODLayer)
+            return CODLayer->add(RT, std::move(TSM));
+        return OptimizeLayer.add(RT, std::move(TSM));
+    }
+    
+    llvm::Error addGlobalsModule(ThreadSafeModule TSM) {
+        return CompileLayer.add(GlobalsJD, std::move(TSM));
+    }
+    
+    // Link an object compiled ahead of time (a snapshot) into MainJD. Its code
+    // stays for as long as the JIT does, and so does Image, the mapped file Obj
+    // points into if it does not own its memory.
+    llvm::Error addObjectFile(std::unique_ptr<llvm::MemoryBuffer> Obj,
+                              std::unique_ptr<llvm::MemoryBuffer> Image = nullptr) {
+        if (Image)
+            Images.push_back(std::move(Image));
+        return ObjLayer->add(MainJD, std::move(Obj));
     }
     
+    // A dylib of its own for the unit Name, compiled apart (see code/unit.h).
+    // It links against the units added before it, among them those it imports,
+    // and MainJD links against it.
+    llvm::Expected<JITDylib &> addUnit(const std::string &Name) {
+        auto JD = ES->createJITDylib("<unit " + Name + ">");
+        if (!JD)
+            return JD.takeError();
+        if (auto Err = addRuntimeGenerator(*JD))
+            return std::move(Err);
+        JD->addToLinkOrder(GlobalsJD);
+        for (auto *U: Units)
+            JD->addToLinkOrder(*U);
+        MainJD.addToLinkOrder(*JD);
+        Units.push_back(&*JD);
+        UnitsByName[Name] = &*JD;
+        return *JD;
+    }
+    
+    // The dylib of the unit Name, null if it was not added.
+    JITDylib *getUnit(const std::string &Name) {
+        auto It = UnitsByName.find(Name);
+        return It == UnitsByName.end() ? nullptr : It->second;
+    }
+    
+    // Link the object of a unit into its dylib, like addObjectFile. Each of Fns
+    // has its body there as Name$1 and is exported as Name, without a stub:
+    // only the importers' own definitions can shadow it.
+    llvm::Error addUnitObject(JITDylib &JD, std::unique_ptr<llvm::MemoryBuffer> Obj,
+                              std::unique_ptr<llvm::MemoryBuffer> Image, const std::vector<std::string> &Fns) {
+        if (Image)
+            Images.push_back(std::move(Image));
+        if (auto Err = ObjLayer->add(JD, std::move(Obj)))
+            return Err;
+        SymbolAliasMap Aliases;
+        for (const auto &Name: Fns)
+            Aliases[Mangle(Name)] = {Mangle(Name + "$1"), llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable};
+        return JD.define(symbolAliases(std::move(Aliases)));
+    }
+    
+    // Start compiling the module defining Name in the background. A later
+    // lookup only blocks if it is not ready by then. Lazy mode compiles on
+    // first call instead, so there is nothing to start.
+    void prefetch(llvm::StringRef Name) {
+        if (CODLayer)
+            return;
+        ES->lookup(LookupKind::Static, makeJITDylibSearchOrder(&MainJD),
+                   SymbolLookupSet(Mangle(Name.str())), SymbolState::Ready,
+                   [this](llvm::Expected<SymbolMap> Result) {
+                       if (!Result)
+                           ES->reportError(Result.takeError());
+                   },
+                   NoDependenciesToRegister);
+    }
+    
+    // Make a host function callable from JIT'd code under Name.
+    llvm::Error addHostFunction(llvm::StringRef Name, ExecutorAddr Addr) {
+        if (auto Err = MainJD.define(absoluteSymbols(
+                {{Mangle(Name.str()), {Addr, llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable}}})))
+            return Err;
+        HostFunctions.insert(Name);
+        return llvm::Error::success();
+    }
+    
+    bool hasHostFunction(llvm::StringRef Name) const { return HostFunctions.contains(Name); }
+    
+    // Add TSM, which defines the body Impl of fn Name, under a tracker of its
+    // own and point the stub Name at Impl. The first body is compiled in the
+    // background once Name is looked up (see prefetch), later ones right away.
+    // With Replaces set, Impl is only swapped in if the stub still points at
+    // Replaces. The previous body is retired. Returns whether Impl was swapped in.
+    llvm::Expected<bool> defineFunction(const std::string &Name, const std::string &Impl, ThreadSafeModule TSM,
+                                        const std::string &Replaces = "") {
+        std::lock_guard<std::mutex> Guard(StubsMutex);
+        auto It = StubTargets.find(Name);
+        if (!Replaces.empty() && (It == StubTargets.end() || It->second.Impl != Replaces))
+            return false;
+        
+        // On any failure the new body goes again, its name is never linked.
+        auto RT = MainJD.createResourceTracker();
+        if (auto Err = OptimizeLayer.add(RT, std::move(TSM)))
+            return llvm::joinErrors(std::move(Err), RT->remove());
+        
+        if (It == StubTargets.end()) {
+            if (auto Err = defineStub(Name, Impl, RT))
+                return llvm::joinErrors(std::move(Err), RT->remove());
+            return true;
+        }
+        
+        // Make sure the stub exists, then compile the new body and swap it in.
+        // The pointer is written in one store, a running call finishes in the
+        // old body and the next one enters the new.
+        if (auto Stub = lookup(Name); !Stub) {
+            // The first body failed to link, which was reported then, and ORC
+            // keeps the stub failed for good. A new stub leads to Impl.
+            llvm::consumeError(Stub.takeError());
+            StubTarget Failed = std::move(It->second);
+            StubTargets.erase(It);
+            llvm::Error Err = Failed.StubRT->remove();
+            if (Failed.RT)
+                Err = llvm::joinErrors(std::move(Err), Failed.RT->remove());
+            if (!Err)
+                Err = defineStub(Name, Impl, RT);
+            if (Err)
+                return llvm::joinErrors(std::move(Err), RT->remove());
+            return true;
+        }
+        auto Sym = lookup(Impl);
+        if (!Sym)
+            return llvm::joinErrors(Sym.takeError(), RT->remove());
+        if (auto Err = Stubs->updatePointer(Name, Sym->getAddress()))
+            return llvm::joinErrors(std::move(Err), RT->remove());
+        Retired.push_back(std::move(It->second.RT));
+        It->second.Impl = Impl;
+        It->second.RT = std::move(RT);
+        return true;
+    }
+    
+    // Put the fn Name behind a stub leading to Impl, a body already linked in
+    // with addObjectFile. Later definitions of Name replace it like any other.
+    llvm::Error defineFunction(const std::string &Name, const std::string &Impl) {
+        std::lock_guard<std::mutex> Guard(StubsMutex);
+        return defineStub(Name, Impl, nullptr);
+    }
+    
+    // Free the retired bodies. Only call this while no JIT'd code is running,
+    // between two top-level items.
+    void reclaim() {
+        std::vector<ResourceTrackerSP> Free;
+        {
+            std::lock_guard<std::mutex> Guard(StubsMutex);
+            Free.swap(Retired);
+        }
+        for (auto &RT: Free) {
+            if (!RT)
+                continue;
+            if (auto Err = RT->remove())
+                ES->reportError(std::move(Err));
+        }
+    }
+    
+    // Call the void() fn at Addr where JIT'd code runs. Only fails if that is
+    // a worker and the worker is gone.
+    llvm::Error run(ExecutorAddr Addr) {
+        if (auto Result = ES->getExecutorProcessControl().runAsVoidFunction(Addr); !Result)
+            return Result.takeError();
+        return llvm::Error::success();
+    }
+    
+    // Report Err like the JIT's own failures, for tasks on its threads.
+    void reportError(llvm::Error Err) { ES->reportError(std::move(Err)); }
+    
+    // Run Fn on the JIT's thread pool.
+    void dispatch(llvm::unique_function<void()> Fn, const char *Desc) {
+        ES->dispatchTask(makeGenericNamedTask(std::move(Fn), Desc));
+    }
+    
+    // Name in MainJD, then in the imported units.
     llvm::Expected<ExecutorSymbolDef> lookup(llvm::StringRef Name) {
-        return ES->lookup({&MainJD}, Mangle(Name.str()));
+        return ES->lookup(searchOrder({&MainJD}), Mangle(Name.str()));
+    }
+    
+    llvm::Expected<ExecutorSymbolDef> lookup(JITDylib &JD, llvm::StringRef Name) {
+        return ES->lookup({&JD}, Mangle(Name.str()));
+    }
+    
+    // The address of a global, in its own dylib, in MainJD for a snapshot or
+    // in the unit defining it.
+    llvm::Expected<ExecutorSymbolDef> lookupGlobal(llvm::StringRef Name) {
+        return ES->lookup(searchOrder({&MainJD, &GlobalsJD}), Mangle(Name.str()));
+    }
+
+private:
+    // The runtime fns (printd, ...) of the process running the code.
+    llvm::Error addRuntimeGenerator(JITDylib &JD) {
+        if (Remote) {
+            auto Gen = EPCDynamicLibrarySearchGenerator::GetForTargetProcess(*ES);
+            if (!Gen)
+                return Gen.takeError();
+            JD.addGenerator(std::move(*Gen));
+        } else {
+            JD.addGenerator(cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(DL.getGlobalPrefix())));
+        }
+        return llvm::Error::success();
+    }
+    
+    // First, then the units.
+    JITDylibSearchOrder searchOrder(std::vector<JITDylib *> First) {
+        First.insert(First.end(), Units.begin(), Units.end());
+        return makeJITDylibSearchOrder(First);
+    }
+    
+    // Define Name as a stub created on first lookup, under a tracker of its
+    // own so a failed one can be replaced. StubsMutex must be held.
+    llvm::Error defineStub(const std::string &Name, const std::string &Impl, ResourceTrackerSP RT) {
+        auto ImplSym = Mangle(Impl);
+        auto MU = std::make_unique<StubMaterializationUnit>(
+                Mangle(Name), [this, Name, ImplSym](std::unique_ptr<MaterializationResponsibility> R) {
+                    materializeStub(std::move(R), Name, ImplSym);
+                });
+        auto StubRT = MainJD.createResourceTracker();
+        if (auto Err = MainJD.define(std::move(MU), StubRT))
+            return Err;
+        StubTargets[Name] = {Impl, std::move(RT), std::move(StubRT)};
+        return llvm::Error::success();
+    }
+    
+    // Compile the first body of Name on the JIT's threads, then resolve Name to
+    // a new stub pointing at it.
+    void materializeStub(std::unique_ptr<MaterializationResponsibility> R, const std::string &Name,
+                         const SymbolStringPtr &Impl) {
+        std::shared_ptr<MaterializationResponsibility> SharedR(std::move(R));
+        ES->lookup(LookupKind::Static, makeJITDylibSearchOrder(&MainJD), SymbolLookupSet(Impl),
+                   SymbolState::Ready,
+                   [this, SharedR, Name](llvm::Expected<SymbolMap> Result) {
+                       auto Flags = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+                       llvm::Error Err = Result.takeError();
+                       if (!Err)
+                           Err = Stubs->createStub(Name, Result->begin()->second.getAddress(), Flags);
+                       if (!Err)
+                           Err = SharedR->notifyResolved(
+                                   {{SharedR->getSymbols().begin()->first, Stubs->findStub(Name, true)}});
+                       if (!Err)
+                           Err = SharedR->notifyEmitted();
+                       if (Err) {
+                           ES->reportError(std::move(Err));
+                           SharedR->failMaterialization();
+                       }
+                   },
+                   NoDependenciesToRegister);
     }
 };
 
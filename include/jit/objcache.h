@@ -0,0 +1,48 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_OBJCACHE_H
+#define DUST_OBJCACHE_H
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Object files of JIT'd modules kept in a directory across runs.
+// A module is tagged with its key (a hash of its IR, of the passes it goes
+// through and of the target) before
+// it is optimized, so on a hit both optimization and codegen are skipped and
+// the cached object is linked as is. Least recently used objects are evicted
+// once the directory grows beyond MaxSize bytes.
+class ObjectFileCache : public llvm::ObjectCache {
+    std::string Dir;
+    uint64_t MaxSize;
+    // triple, CPU and features, part of every key
+    std::string TargetId;
+
+    std::mutex Lock;
+    uint64_t TotalSize = 0;
+
+    std::string pathFor(llvm::StringRef Key) const;
+
+    // Remove the oldest objects until TotalSize fits, Lock must be held.
+    void evict();
+
+public:
+    ObjectFileCache(std::string Dir, uint64_t MaxSize, std::string TargetId);
+
+    // Set M's identifier to the key of its current IR and of Pipeline, the
+    // passes it is optimized with. Returns true if an object for that key is
+    // cached, then M need not be optimized.
+    bool tagModule(llvm::Module &M, llvm::StringRef Pipeline);
+
+    void notifyObjectCompiled(const llvm::Module *M, llvm::MemoryBufferRef Obj) override;
+
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) override;
+};
+
+#endif //DUST_OBJCACHE_H
@@ -0,0 +1,137 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_SLABMM_H
+#define DUST_SLABMM_H
+
+#include "llvm/ExecutionEngine/Orc/MemoryMapper.h"
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/Support/Alignment.h"
+#include "llvm/Support/Memory.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Bytes of JIT memory mapped, and bytes of it handed out to JIT'd code.
+struct JITMemoryStats {
+    std::atomic<uint64_t> Reserved{0};
+    std::atomic<uint64_t> Used{0};
+    // Of Reserved, code on huge pages for sure, and code the system was asked
+    // to back by huge pages, which it may or may not have done.
+    std::atomic<uint64_t> Huge{0};
+    std::atomic<uint64_t> HugeHinted{0};
+};
+
+// Code and data of all JIT'd objects packed into a few large slabs instead of
+// pages of their own per object. Every function and top-level expression is an
+// object, most of them far smaller than a page.
+// Code slabs are mapped read-write-execute up front: objects share pages, and
+// flipping a page back to writable would pull it from under code running in it.
+// Where that is refused (W^X policies such as SELinux deny_execmem), the JIT
+// goes back to a SectionMemoryManager per object.
+class SlabAllocator {
+    struct Pool {
+        std::vector<llvm::sys::MemoryBlock> Slabs;
+        // Free ranges by address, adjacent ones are merged.
+        std::map<uint8_t *, uintptr_t> Free;
+    };
+
+    Pool CodePool, DataPool;
+    std::mutex Lock;
+    std::shared_ptr<JITMemoryStats> Stats;
+    // Back code slabs by 2 MB pages where the system allows, so hot code
+    // takes few iTLB entries.
+    bool HugePages;
+
+    // Map a new slab of at least MinSize bytes into P, close to Near if
+    // possible, Lock must be held.
+    bool grow(Pool &P, bool Code, uintptr_t MinSize, const uint8_t *Near);
+
+public:
+    // How far the data of an object may be from its code. RuntimeDyld's
+    // PC-relative relocations reach 2 GB, the rest is left for the sizes.
+    static constexpr uintptr_t MaxDistance = uintptr_t(1) << 30;
+
+    SlabAllocator(std::shared_ptr<JITMemoryStats> Stats, bool HugePages);
+
+    ~SlabAllocator();
+
+    // Map the first code slab, false if the system refuses memory that is
+    // writable and executable at once.
+    bool mapsCode();
+
+    // Given Near, only memory within MaxDistance of it, nullptr if there is
+    // none to be had.
+    uint8_t *allocate(bool Code, uintptr_t Size, unsigned Alignment, const uint8_t *Near = nullptr);
+
+    void release(bool Code, uint8_t *Addr, uintptr_t Size);
+};
+
+// The RuntimeDyld memory manager of one object, its sections come out of the
+// shared slabs and go back when the object is removed from the JIT.
+// The object's code and data are taken from the slabs in one go, before its
+// sections are laid out, so they end up within reach of each other's
+// relocations. Data that can't be placed near the code shares its block.
+class SlabMemoryManager : public llvm::RTDyldMemoryManager {
+    struct Allocation {
+        bool Code;
+        uint8_t *Addr;
+        uintptr_t Size;
+    };
+
+    std::shared_ptr<SlabAllocator> Slabs;
+    std::vector<Allocation> Allocations;
+    // What is left of the blocks taken for the object.
+    uint8_t *CodeNext = nullptr, *CodeEnd = nullptr;
+    uint8_t *DataNext = nullptr, *DataEnd = nullptr;
+
+    uint8_t *take(uint8_t *&Next, uint8_t *End, uintptr_t Size, unsigned Alignment);
+
+public:
+    explicit SlabMemoryManager(std::shared_ptr<SlabAllocator> Slabs) : Slabs(std::move(Slabs)) {}
+
+    ~SlabMemoryManager() override;
+
+    bool needsToReserveAllocationSpace() override { return true; }
+
+    void reserveAllocationSpace(uintptr_t CodeSize, llvm::Align CodeAlign, uintptr_t RODataSize,
+                                llvm::Align RODataAlign, uintptr_t RWDataSize, llvm::Align RWDataAlign) override;
+
+    uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID,
+                                 llvm::StringRef SectionName) override;
+
+    uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID,
+                                 llvm::StringRef SectionName, bool IsReadOnly) override;
+
+    bool finalizeMemory(std::string *ErrMsg) override;
+};
+
+// The mapper under JITLink's MapperJITLinkMemoryManager, which already packs
+// allocations into large reservations. It only adds the counting.
+class CountingMemoryMapper : public llvm::orc::InProcessMemoryMapper {
+    std::shared_ptr<JITMemoryStats> Stats;
+    std::mutex Lock;
+    std::map<llvm::orc::ExecutorAddr, uint64_t> Reservations;
+    std::map<llvm::orc::ExecutorAddr, uint64_t> Allocations;
+
+public:
+    CountingMemoryMapper(size_t PageSize, std::shared_ptr<JITMemoryStats> Stats)
+            : InProcessMemoryMapper(PageSize), Stats(std::move(Stats)) {}
+
+    static llvm::Expected<std::unique_ptr<CountingMemoryMapper>> Create(std::shared_ptr<JITMemoryStats> Stats);
+
+    void reserve(size_t NumBytes, OnReservedFunction OnReserved) override;
+
+    void initialize(AllocInfo &AI, OnInitializedFunction OnInitialized) override;
+
+    void deinitialize(llvm::ArrayRef<llvm::orc::ExecutorAddr> Allocs,
+                      OnDeinitializedFunction OnDeinitialized) override;
+
+    void release(llvm::ArrayRef<llvm::orc::ExecutorAddr> Reservs, OnReleasedFunction OnReleased) override;
+};
+
+#endif //DUST_SLABMM_H
@@ -0,0 +1,47 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_WORKER_H
+#define DUST_WORKER_H
+
+#include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
+#include "llvm/Support/Error.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Worker processes run JIT'd code for the compiler, each a copy of this
+// program started with --executor. Code is compiled and linked in the
+// compiler, then written into the worker over a pair of pipes and run
+// there, so a crash takes down only the worker. POSIX only.
+
+// Start a worker and connect to it, the JIT on top of the returned control
+// runs its code there. The worker exits once the JIT is gone.
+llvm::Expected<std::unique_ptr<llvm::orc::ExecutorProcessControl>> LaunchWorker();
+
+// The main of a worker, serves the compiler on these pipes until it disconnects.
+int RunWorker(int InFD, int OutFD);
+
+// Kills the worker last launched on this thread if it is still running when
+// Seconds have passed, the JIT on it then fails whatever it runs. Over once
+// destroyed.
+class WorkerDeadline {
+    std::mutex Lock;
+    std::condition_variable Cancel;
+    bool Over = false;
+    std::atomic<bool> Expired = false;
+    std::thread Watch;
+
+public:
+    explicit WorkerDeadline(unsigned Seconds);
+
+    ~WorkerDeadline();
+
+    // Whether the worker was killed.
+    bool expired() const { return Expired; }
+};
+
+#endif //DUST_WORKER_H
@@ -51,7 +51,17 @@ f(SEMICON_TK)            \
     f(ASSIGN_TK)         \
     f(VAR_TK)            \
     f(RET_TK)            \
-    f(STR_TK)
+    f(STR_TK)            \
+    f(CONST_TK)          \
+    f(MATCH_TK)          \
+    f(ARROW_TK)          \
+    f(STRUCT_TK)         \
+    f(GEN_TK)            \
+    f(YIELD_TK)          \
+    f(IN_TK)             \
+    f(AND_TK)            \
+    f(OR_TK)             \
+    f(IMPORT_TK)
     
     
     enum TokenId {
@@ -78,8 +88,8 @@ f(SEMICON_TK)            \
     
     std::vector<Token> lexFile(std::ifstream&);
     std::vector<Token>lexLine(const std::string &line);
-    // these are defined in lexer.cc
-    extern std::vector<Token> tokens;
-    extern size_t tokIndex ;
+    // these are defined in lexer.cc, one stream per thread
+    extern thread_local std::vector<Token> tokens;
+    extern thread_local size_t tokIndex ;
 }
 #endif //DUST_LEXER_H
@@ -10,7 +10,12 @@
 #include "lexer/lexer.h"
 #include "utils/minilog.h"
 #include <map>
+#include <optional>
 #include "ast/func.h"
+#include "ast/global.h"
+#include "ast/struct.h"
+#include "ast/generator.h"
+#include "parser/scope.h"
 using namespace dust;
 
 
@@ -19,28 +24,68 @@ using namespace dust;
 namespace dust::parser{
     using namespace ast;
     using uexpr = std::unique_ptr<ast::ExprAST>;
-    // these are defined in initializer.cc
-    extern std::unique_ptr<llvm::LLVMContext> TheContext;
-    extern std::unique_ptr<llvm::IRBuilder<>> Builder;
-    extern std::unique_ptr<llvm::Module> TheModule;
-    extern std::map<std::string, std::pair<llvm::AllocaInst *,llvm::Type*>> NamedValues;
-    extern std::unique_ptr<DustJIT> TheJIT;
-    extern std::unique_ptr<llvm::FunctionPassManager> TheFPM;
-    extern std::unique_ptr<llvm::LoopAnalysisManager> TheLAM;
-    extern std::unique_ptr<llvm::FunctionAnalysisManager> TheFAM;
-    extern std::unique_ptr<llvm::CGSCCAnalysisManager> TheCGAM;
-    extern std::unique_ptr<llvm::ModuleAnalysisManager> TheMAM;
-    extern std::unique_ptr<llvm::PassInstrumentationCallbacks> ThePIC;
-    extern std::unique_ptr<llvm::StandardInstrumentations> TheSI;
-    extern std::map<std::string, std::unique_ptr<ast::PrototypeAST>> FunctionProtos;
-    extern llvm::ExitOnError ExitOnErr;
+    // these are defined in initializer.cc, every thread compiles with a state
+    // of its own (see Engine)
+    // the context of TheModule, owned by TheTSContext
+    extern thread_local llvm::orc::ThreadSafeContext TheTSContext;
+    extern thread_local llvm::LLVMContext *TheContext;
+    extern thread_local std::unique_ptr<llvm::IRBuilder<>> Builder;
+    extern thread_local std::unique_ptr<llvm::Module> TheModule;
+    extern thread_local ScopedSymbolTable NamedValues;
+    extern thread_local std::unique_ptr<DustJIT> TheJIT;
+    extern thread_local std::unique_ptr<llvm::FunctionPassManager> TheFPM;
+    extern thread_local std::unique_ptr<llvm::LoopAnalysisManager> TheLAM;
+    extern thread_local std::unique_ptr<llvm::FunctionAnalysisManager> TheFAM;
+    extern thread_local std::unique_ptr<llvm::CGSCCAnalysisManager> TheCGAM;
+    extern thread_local std::unique_ptr<llvm::ModuleAnalysisManager> TheMAM;
+    extern thread_local std::unique_ptr<llvm::PassInstrumentationCallbacks> ThePIC;
+    extern thread_local std::unique_ptr<llvm::StandardInstrumentations> TheSI;
+    extern thread_local std::map<std::string, std::unique_ptr<ast::PrototypeAST>> FunctionProtos;
+    extern thread_local std::map<std::string, std::unique_ptr<ast::GlobalVarAST>> GlobalVars;
+    extern thread_local std::map<std::string, std::unique_ptr<ast::StructAST>> StructDecls;
+    extern thread_local std::map<std::string, std::unique_ptr<ast::FunctionAST>> GenericFuncs;
+    extern thread_local std::map<std::string, std::unique_ptr<ast::GeneratorAST>> Generators;
+    // how often each fn was defined successfully
+    extern thread_local std::map<std::string, unsigned> Definitions;
+    // the last N of the bodies (Name$N) behind each fn's stub, only goes up
+    // so the name of a body the JIT refused is never taken again
+    extern thread_local std::map<std::string, unsigned> Versions;
+    // the gen fn being emitted, or nullptr
+    extern thread_local ast::GeneratorState *CurGenerator;
+    // handles of the generators read by the enclosing for-in loops
+    extern thread_local std::vector<llvm::Value *> OpenGenerators;
+    extern thread_local llvm::ExitOnError ExitOnErr;
     //defined in parser.cc
-    extern std::map<lexer::TokenId, int> BinOpPrecedence;
-    extern std::function<void()> PassToken;
-    extern std::function<lexer::Token()>GetToken;
+    extern const std::map<lexer::TokenId, int> BinOpPrecedence;
+    extern thread_local std::function<void()> PassToken;
+    extern thread_local std::function<lexer::Token()>GetToken;
+    // open a new module in the shared context of top-level expressions
     void InitModuleAndManagers();
+    // replace the (still empty) TheModule by one in a context of its own
+    void UseOwnContext();
+    // hand TheModule over to the JIT
+    llvm::orc::ThreadSafeModule TakeModule();
+    // free TheJIT and everything compiled on this thread, which can start over
+    void ClearState();
+    // run the full module pipeline of the given level over M
+    void OptimizeModule(llvm::Module &M, llvm::OptimizationLevel Level);
+    // the same, tuned for JIT, on threads without a TheJIT of their own
+    void OptimizeModule(llvm::Module &M, llvm::OptimizationLevel Level, DustJIT &JIT);
+    // split the generators in TheModule into state machines before it is JIT'd
+    void LowerCoroutines();
+    // the optimizer run by JIT right before compiling, in lazy mode or with the
+    // object cache. It runs on the JIT's threads, so it gets JIT passed in.
+    llvm::Expected<llvm::orc::ThreadSafeModule> OptimizeJITModule(DustJIT &JIT, llvm::orc::ThreadSafeModule TSM,
+                                                                 const llvm::orc::MaterializationResponsibility &R);
     llvm::Function *getFunction(std::string const& Name);
+    llvm::GlobalVariable *getGlobal(std::string const& Name);
     llvm::Type* getType(lexer::TokenId t);
+    llvm::Type* getType(lexer::TokenId t, std::string const& typeName);
+    llvm::Type* getType(ast::Variable const& v);
+    int getFieldIndex(llvm::Type *T, std::string const& Field);
+    // the dust type an LLVM type was created from, if any
+    std::optional<ast::Variable> getDustType(llvm::Type *T);
+    std::string getTypeName(ast::Variable const& v);
     llvm::AllocaInst *CreateEntryBlockAlloca(llvm::Function *TheFunction,llvm::Type*,
                                              const std::string &VarName);
     uexpr parseExpression();
@@ -51,10 +96,16 @@ namespace dust::parser{
     
     std::unique_ptr<FunctionAST> parseFuncDef();
     
+    std::unique_ptr<GeneratorAST> parseGenDef();
+    
     std::unique_ptr<FunctionAST> parseTopLevelExpr();
     
     std::unique_ptr<PrototypeAST> parseExtern();
+    // the file named by import "file";, empty on a syntax error
+    std::string parseImport();
     std::unique_ptr<ExprAST> parseIfExpr();
+    std::vector<std::unique_ptr<GlobalVarAST>> parseGlobalVar();
+    std::unique_ptr<StructAST> parseStructDef();
     enum ParseMode{
         Interactive=0,
         File
@@ -64,8 +115,97 @@ namespace dust::parser{
     
     void InterpretFuncDef();
     
+    // compile a parsed fn definition and make it the fn's current body
+    void JITFunction(FunctionAST &fnAST);
+    
     void InterpretTopLevelExpr();
     
+    // call the void() fn at Fn where JIT'd code runs, false if that is a
+    // worker which died, the rest of the script is skipped then
+    bool RunJITCode(llvm::orc::ExecutorAddr Fn);
+    
+    // whether Err is set, it is logged as the JIT failing What then
+    bool JITFailed(llvm::Error Err, const std::string &What);
+    
+    // median time of a top-level evaluation --latency holds the REPL to, in ms
+    inline constexpr double LatencyTarget = 1.0;
+    
+    // print the latencies recorded with --latency, false if their median
+    // misses LatencyTarget
+    bool PrintLatencyStats();
+    
     void InterpretExtern();
+    
+    void InterpretGlobalVar();
+    
+    // load the imported unit (see code/unit.h) into the JIT
+    void InterpretImport();
+    
+    //defined in specialize.cc
+    // the bitcode of TheModule, as handed to the JIT
+    llvm::SmallVector<char, 0> ModuleBitcode();
+    
+    // keep Bitcode, that of the module defining Name, once the JIT took it
+    void RecordFunctionIR(const std::string &Name, llvm::SmallVector<char, 0> Bitcode);
+    
+    // the bitcode recorded for Name, empty if there is none
+    llvm::StringRef GetFunctionIR(const std::string &Name);
+    
+    // forget the recorded bitcode and the clones made from it
+    void ClearFunctionIR();
+    
+    bool RunSpecialized(FunctionAST &TopLevel);
+    
+    // copy the recorded bodies of the fns M calls into M, available_externally,
+    // so the inliner can weigh hot calls across definitions
+    void ImportCallees(llvm::Module &M);
+    
+    //defined in batch.cc
+    // JIT a loop calling the recorded body of the num fn Name once per row,
+    // void(double **Columns, double *Out, i64 Rows), and return its name,
+    // "" (after printing the problem) if Name can not be batched
+    std::string BatchFunction(const std::string &Name);
+    
+    //defined in profile.cc
+    // count the entries and branch outcomes of F with --profile-generate, or
+    // attach the loaded counts as entry count and branch weights with --profile-use
+    void ProfileFunction(llvm::Function &F);
+    
+    // write the counts of --profile-generate
+    void WriteProfile(const std::string &Path);
+    
+    // with --profile-generate ahead of time, where the counters are in the
+    // program: hand those in TheModule to the runtime, which writes them out
+    // on exit. Emitted at the insert point, in the init function.
+    void EmitProfileRegistration();
+    
+    bool LoadProfile(const std::string &Path);
+    
+    // drop the counts, generated or loaded
+    void ClearProfiles();
+    
+    //defined in tiering.cc
+    // count the calls and loop iterations of F, a body behind a stub, and
+    // replace it by an O3 build once it is hot
+    void InstrumentTier0(llvm::Function &F);
+    
+    void InterpretStruct();
+    
+    void InterpretGenDef();
+    
+    // The same for ahead-of-time compilation, everything goes into TheModule.
+    // Generic fns, generators and structs are handled by their Interpret* above.
+    void CompileFuncDef();
+    
+    // the __anon_expr holding the statements
+    llvm::Function *CompileTopLevelExpr();
+    
+    // the __anon_exprs running the non-literal initializers
+    std::vector<llvm::Function *> CompileGlobalVar();
+    
+    void CompileExtern();
+    
+    // declare the imported unit, the snapshot being compiled imports it
+    void CompileImport();
 }
 #endif //DUST_PARSER_H
@@ -0,0 +1,51 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_SCOPE_H
+#define DUST_SCOPE_H
+
+#include <string>
+#include <vector>
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Instructions.h"
+
+namespace dust::parser{
+
+    // A local variable: the stack slot created for it and the type stored there.
+    struct Binding {
+        llvm::AllocaInst *Alloca = nullptr;
+        llvm::Type *Type = nullptr;
+    };
+
+    // Symbol table for the function being generated.
+    // All live bindings sit in one flat vector, and every name hashes to the
+    // index of its innermost binding. Each entry remembers the binding it
+    // shadows, so leaving a scope just unwinds the entries declared in it.
+    class ScopedSymbolTable {
+        struct Entry {
+            llvm::StringMapEntry<int> *Slot;
+            Binding Bind;
+            int Shadowed;
+        };
+
+        llvm::StringMap<int> Innermost;
+        std::vector<Entry> Entries;
+        std::vector<size_t> Scopes;
+
+    public:
+        void pushScope();
+
+        void popScope();
+
+        void declare(llvm::StringRef Name, Binding B);
+
+        // Returns the innermost binding of Name, or nullptr if it is not in scope.
+        [[nodiscard]] const Binding *lookup(llvm::StringRef Name) const;
+
+        // Drop every binding, used when starting a new function.
+        void clear();
+    };
+}
+
+#endif //DUST_SCOPE_H
@@ -0,0 +1,35 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_SERVER_H
+#define DUST_SERVER_H
+
+#include <string>
+
+// A compile server, so short scripts skip the startup of the compiler.
+//
+// `dust --serve S` sets up the JIT once and waits on the Unix socket S.
+// `dust --client S f.ds` sends the source of f.ds, with its stdout and stderr,
+// and exits with the script's status. The server forks for every request.
+// The child starts from the warm JIT, writes to the client's terminal, and
+// crashes or fatal errors only end that child.
+//
+// Scripts are compiled once into a snapshot image (see code/snapshot.h),
+// named after the hash of their name and source, the --load prelude, the
+// target and the dust binary, in the cache directory. Later requests for
+// the same script only load the image and run it. The socket is only open
+// to the user running the server.
+//
+// Requests: u32 name length, u32 source length, the name, the source, with
+// the client's stdout and stderr passed along (SCM_RIGHTS). Replies: i32
+// status, 0 if the script was compiled and run. POSIX only.
+namespace dust::server{
+    // Serve on Socket with the engine of this thread until killed.
+    int Serve(const std::string &Socket);
+
+    // Run Source on the server listening on Socket.
+    int RunClient(const std::string &Socket, const std::string &Source);
+}
+
+#endif //DUST_SERVER_H
@@ -32,6 +32,8 @@ namespace minilog
     namespace details
     {
         inline LogLevel g_minlevel = LogLevel::debug;
+        // errors and fatals logged by this thread, shown or not
+        inline thread_local unsigned g_errors = 0;
         inline std::ofstream g_logfile = []
         {if(auto path=getenv("MINILOG_PATH")){return std::ofstream{path,std::ios::app};}return std::ofstream(); }();
         
@@ -66,6 +68,10 @@ namespace minilog
     {
         details::g_minlevel = lev;
     }
+    inline unsigned error_count()
+    {
+        return details::g_errors;
+    }
     namespace details
     {
 
@@ -125,6 +131,10 @@ namespace minilog
             auto msg = std::vformat(fmt_with_loc.data().get(), std::make_format_args(args...));
             std::chrono::zoned_time now{std::chrono::current_zone(), std::chrono::system_clock::now()};
             msg = std::format("{} {}:{} [{}] {}", now, loc.file_name(), loc.line(), details::getstr_from_level(lev), msg);
+            if (lev >= LogLevel::error)
+            {
+                ++g_errors;
+            }
             if (lev >= g_minlevel)
             {
                 if (g_logfile)
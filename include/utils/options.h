@@ -0,0 +1,96 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#ifndef DUST_OPTIONS_H
+#define DUST_OPTIONS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dust{
+
+    // Command line switches, filled in by ParseOptions.
+    struct Options {
+        // What becomes of Source.
+        enum class OutputKind {
+            // run it in the JIT
+            JIT,
+            // -c, a native object file
+            Object,
+            // --shared, a shared library
+            Shared,
+            // --exe, an executable running the top-level statements
+            Executable,
+            // --snapshot, an image of the compiled session for --load
+            Snapshot
+        };
+        
+        // source file to run, empty for the interactive mode
+        std::string Source;
+        // more source files, run alongside Source with --workers
+        std::vector<std::string> Scripts;
+        // run every source file in a worker process of its own, this many at
+        // a time, 0 to run in this process
+        unsigned Workers = 0;
+        // --timeout, seconds a script may run in its worker before the worker
+        // is killed and the script fails, 0 for no limit
+        unsigned Timeout = 0;
+        // --serve, the Unix socket to take scripts on (see server/server.h)
+        std::string ServeSocket;
+        // --client, the socket of the server to run Source on
+        std::string ClientSocket;
+        // --executor, the pipes of the compiler this process is a worker of
+        int WorkerIn = -1;
+        int WorkerOut = -1;
+        // print what is read, with the IR of each definition, to stderr
+        bool Echo = true;
+        // run top-level calls with literal arguments through a clone of the
+        // callee specialized on those constants
+        bool Specialize = false;
+        // compile each function on its first call instead of when it is defined
+        bool Lazy = false;
+        // compile fns quickly with call counters first, and again at O3 once hot
+        bool Tiered = false;
+        // keep the IR of every fn JIT'd for Engine::batch, which has no switch
+        bool Batch = false;
+        // run fns and top-level statements as bytecode, fns are JIT'd once hot
+        bool Interp = false;
+        // calls plus loop iterations after which a tiered fn is recompiled, or
+        // an interpreted one compiled
+        uint64_t TierThreshold = 1000;
+        // count branches and calls, and write the counts to this file on exit,
+        // that of the compiled program once it ran its init function
+        std::string ProfileGenerate;
+        // optimize with the counts in this file, written by --profile-generate
+        std::string ProfileUse;
+        // link with JITLink instead of RuntimeDyld
+        bool JITLink = false;
+        // back JIT'd code by huge pages where the system allows
+        bool HugePages = false;
+        // print how much JIT memory is reserved and used on exit
+        bool MemStats = false;
+        // time every top-level evaluation, print the distribution on exit and
+        // fail if the median misses parser::LatencyTarget
+        bool Latency = false;
+        // keep compiled objects in this directory across runs, empty for no cache
+        std::string CacheDir;
+        // size bound of CacheDir in bytes
+        uint64_t CacheSize = 256ull << 20;
+        // compile Source ahead of time instead of running it
+        OutputKind Output = OutputKind::JIT;
+        // -o, the file written when compiling ahead of time
+        std::string OutputPath;
+        // snapshot written by --snapshot, loaded before Source or the prompt
+        std::string LoadImage;
+    };
+    
+    // those of the Engine on this thread
+    extern thread_local Options Opts;
+    
+    // Returns false (after printing the problem) if the command line is invalid.
+    bool ParseOptions(int argc, char **argv);
+}
+
+#endif //DUST_OPTIONS_H
@@ -8,7 +8,54 @@
 #endif
 
 #include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+// The counters of a program compiled with --profile-generate, see
+// dust::parser::EmitProfileRegistration.
+struct ProfiledFn {
+    const char *Name;
+    const uint64_t *Counts;
+    uint64_t Size;
+};
+const char *ProfilePath = nullptr;
+
+std::vector<ProfiledFn> &profiledFns() {
+    static std::vector<ProfiledFn> Fns;
+    return Fns;
+}
+
+// In the format of dust::parser::WriteProfile.
+void writeProfile() {
+    FILE *Out = fopen(ProfilePath, "w");
+    if (!Out) {
+        fprintf(stderr, "can not write profile %s\n", ProfilePath);
+        return;
+    }
+    for (const auto &F: profiledFns()) {
+        fprintf(Out, "fn %s %llu %llu\n", F.Name, (unsigned long long) F.Counts[0],
+                (unsigned long long) (F.Size - 1) / 2);
+        for (uint64_t i = 1; i < F.Size; i += 2)
+            fprintf(Out, "%llu %llu\n", (unsigned long long) F.Counts[i], (unsigned long long) F.Counts[i + 1]);
+    }
+    fclose(Out);
+}
+}
+
 extern "C" {
+DLLEXPORT void dust_profile_register(const char *Path, const char *Name, const uint64_t *Counts, uint64_t Size) {
+    // Made before the handler is registered, so it is destroyed after it ran.
+    auto &Fns = profiledFns();
+    if (!ProfilePath) {
+        ProfilePath = Path;
+        atexit(writeProfile);
+    }
+    Fns.push_back({Name, Counts, Size});
+}
+
 DLLEXPORT double putchard(double X) {
     fputc((char) X, stderr);
     return 0;
@@ -21,6 +68,10 @@ DLLEXPORT double prints(const char *X) {
     fprintf(stderr, "%s\n", X);
     return 0;
 }
+DLLEXPORT double clockd() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
 DLLEXPORT double scand() {
     double ret;
     scanf("%lf", &ret);
@@ -3,6 +3,7 @@
 //
 #include "ast/expr.h"
 #include "parser/parser.h"
+#include "ast/func.h"
 
 namespace dust::ast{
     using namespace parser;
@@ -19,19 +20,116 @@ namespace dust::ast{
     }
     
     llvm::Value *VariableExprAST::codegen() {
-        // Look this variable up in the function.
-        llvm::AllocaInst *A = NamedValues[name].first;
-        if (!A)
-            return nullptr;
+        // Look this variable up in the function, then among the module globals.
+        if (const Binding *B = NamedValues.lookup(name))
+            return Builder->CreateLoad(B->Type, B->Alloca, name.c_str());
+        if (llvm::GlobalVariable *GV = getGlobal(name))
+            return Builder->CreateLoad(GV->getValueType(), GV, name.c_str());
         
-        // Load the value.
-        return Builder->CreateLoad(A->getAllocatedType(), A, name.c_str());
+        minilog::log_error("Unknown variable name: {}", name);
+        return nullptr;
+    }
+    
+    llvm::Value *VariableExprAST::codegenAddress(llvm::Type *&Ty) {
+        if (const Binding *B = NamedValues.lookup(name)) {
+            Ty = B->Type;
+            return B->Alloca;
+        }
+        if (llvm::GlobalVariable *GV = getGlobal(name)) {
+            Ty = GV->getValueType();
+            return GV;
+        }
+        return nullptr;
+    }
+    
+    llvm::Value *MemberExprAST::codegen() {
+        // Fields of a variable are loaded through a GEP on its storage, which
+        // keeps struct locals in a shape SROA can split into scalars.
+        llvm::Type *Ty;
+        if (llvm::Value *Addr = codegenAddress(Ty))
+            return Builder->CreateLoad(Ty, Addr, field);
+        
+        // Otherwise the struct is a temporary, e.g. a call result.
+        llvm::Value *Agg = base->codegen();
+        if (!Agg)
+            return nullptr;
+        int Idx = getFieldIndex(Agg->getType(), field);
+        if (Idx < 0)
+            return nullptr;
+        return Builder->CreateExtractValue(Agg, Idx, field);
+    }
+    
+    llvm::Value *MemberExprAST::codegenAddress(llvm::Type *&Ty) {
+        llvm::Type *BaseTy;
+        llvm::Value *BaseAddr = base->codegenAddress(BaseTy);
+        if (!BaseAddr)
+            return nullptr;
+        int Idx = getFieldIndex(BaseTy, field);
+        if (Idx < 0)
+            return nullptr;
+        auto *ST = llvm::cast<llvm::StructType>(BaseTy);
+        Ty = ST->getElementType(Idx);
+        return Builder->CreateStructGEP(ST, BaseAddr, Idx, field + ".addr");
+    }
+    
+    llvm::Value *ExprAST::codegenCond() {
+        llvm::Value *V = codegen();
+        if (!V)
+            return nullptr;
+        if (!V->getType()->isDoubleTy()) {
+            minilog::log_error("condition must be a num");
+            return nullptr;
+        }
+        // Convert condition to a bool by comparing non-equal to 0.0.
+        return Builder->CreateFCmpONE(V, llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0)), "tobool");
+    }
+    
+    // Operators whose result is a truth value.
+    static bool isConditionOp(lexer::TokenId Op) {
+        switch (Op) {
+            case lexer::LESS_TK:
+            case lexer::LESSEQ_TK:
+            case lexer::GREATER_TK:
+            case lexer::GREATEEQ_TK:
+            case lexer::EQ_TK:
+            case lexer::NOTEQ_TK:
+            case lexer::AND_TK:
+            case lexer::OR_TK:
+                return true;
+            default:
+                return false;
+        }
     }
     
     llvm::Value *BinaryExprAST::codegen() {
         // Special case '=' because we don't want to emit the LHS as an expression.
         if (op.tok == lexer::ASSIGN_TK) {
-            // Assignment requires the LHS to be an identifier.
+            if (auto *LHSM = dynamic_cast<MemberExprAST *>(lhs.get())) {
+                // Fields of a constant global are constant too.
+                ExprAST *Root = LHSM;
+                while (auto *M = dynamic_cast<MemberExprAST *>(Root))
+                    Root = M->getBase();
+                if (auto *RootVar = dynamic_cast<VariableExprAST *>(Root);
+                        RootVar && !NamedValues.lookup(RootVar->getName())) {
+                    auto GI = GlobalVars.find(RootVar->getName());
+                    if (GI != GlobalVars.end() && GI->second->isConst()) {
+                        minilog::log_error("Can not assign to constant: {}", RootVar->getName());
+                        return nullptr;
+                    }
+                }
+                llvm::Value *Val = rhs->codegen();
+                if (!Val)
+                    return nullptr;
+                llvm::Type *Ty;
+                llvm::Value *Addr = LHSM->codegenAddress(Ty);
+                if (!Addr) {
+                    minilog::log_error("Can not assign to a field of a temporary");
+                    return nullptr;
+                }
+                Builder->CreateStore(Val, Addr);
+                return Val;
+            }
+            // Otherwise assignment requires the LHS to be an identifier.
             auto *LHSE = dynamic_cast<VariableExprAST *>(lhs.get());
             if (!LHSE)
                 return nullptr;
@@ -41,12 +139,30 @@ namespace dust::ast{
                 return nullptr;
             
             // Look up the name.
-            llvm::Value *Variable = NamedValues[LHSE->getName()].first;
-            if (!Variable)
+            if (const Binding *Variable = NamedValues.lookup(LHSE->getName())) {
+                Builder->CreateStore(Val, Variable->Alloca);
+                return Val;
+            }
+            auto GI = GlobalVars.find(LHSE->getName());
+            if (GI != GlobalVars.end() && GI->second->isConst()) {
+                minilog::log_error("Can not assign to constant: {}", LHSE->getName());
                 return nullptr;
+            }
+            if (llvm::GlobalVariable *GV = getGlobal(LHSE->getName())) {
+                Builder->CreateStore(Val, GV);
+                return Val;
+            }
             
-            Builder->CreateStore(Val, Variable);
-            return Val;
+            minilog::log_error("Unknown variable name: {}", LHSE->getName());
+            return nullptr;
+        }
+        
+        // Comparisons and logical operators produce an i1, widened to 0.0 or 1.0.
+        if (isConditionOp(op.tok)) {
+            llvm::Value *C = codegenCond();
+            if (!C)
+                return nullptr;
+            return Builder->CreateUIToFP(C, llvm::Type::getDoubleTy(*TheContext), "booltmp");
         }
         
         llvm::Value *L = lhs->codegen();
@@ -63,39 +179,124 @@ namespace dust::ast{
                 return Builder->CreateFMul(L, R, "multmp");
             case lexer::DIV_TK:
                 return Builder->CreateFDiv(L, R, "divtmp");
+            default:
+                minilog::log_fatal("can not parse operator: {}", lexer::to_string(op.tok));
+                return nullptr;
+        }
+    }
+    
+    llvm::Value *BinaryExprAST::codegenCond() {
+        if (op.tok == lexer::AND_TK || op.tok == lexer::OR_TK) {
+            // Short-circuit: the right operand is only evaluated when the left one
+            // does not decide the result already.
+            bool IsAnd = op.tok == lexer::AND_TK;
+            llvm::Value *L = lhs->codegenCond();
+            if (!L)
+                return nullptr;
+            llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+            llvm::BasicBlock *LhsBB = Builder->GetInsertBlock();
+            llvm::BasicBlock *RhsBB = llvm::BasicBlock::Create(*TheContext, IsAnd ? "and.rhs" : "or.rhs",
+                                                               TheFunction);
+            llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(*TheContext, IsAnd ? "and.end" : "or.end");
+            if (IsAnd)
+                Builder->CreateCondBr(L, RhsBB, MergeBB);
+            else
+                Builder->CreateCondBr(L, MergeBB, RhsBB);
+            
+            Builder->SetInsertPoint(RhsBB);
+            llvm::Value *R = rhs->codegenCond();
+            if (!R)
+                return nullptr;
+            Builder->CreateBr(MergeBB);
+            // The right operand may have branched too, the PHI needs its last block.
+            RhsBB = Builder->GetInsertBlock();
+            
+            TheFunction->insert(TheFunction->end(), MergeBB);
+            Builder->SetInsertPoint(MergeBB);
+            llvm::PHINode *PN = Builder->CreatePHI(Builder->getInt1Ty(), 2, IsAnd ? "andtmp" : "ortmp");
+            PN->addIncoming(Builder->getInt1(!IsAnd), LhsBB);
+            PN->addIncoming(R, RhsBB);
+            return PN;
+        }
+        if (!isConditionOp(op.tok))
+            return ExprAST::codegenCond();
+        
+        llvm::Value *L = lhs->codegen();
+        llvm::Value *R = rhs->codegen();
+        if (!L || !R)
+            return nullptr;
+        
+        switch (op.tok) {
             case lexer::LESS_TK:
-                // this function will return a integer, 1 if L < R, 0 for else
-                L = Builder->CreateFCmpULT(L, R, "cmptmp");
-                // Convert the bool returned by CreateFCmpULT to double 0.0 or 1.0
-                return Builder->CreateUIToFP(L, llvm::Type::getDoubleTy(*TheContext),
-                                             "booltmp");
+                return Builder->CreateFCmpULT(L, R, "cmptmp");
             case lexer::LESSEQ_TK:
-                L = Builder->CreateFCmpULE(L, R, "cmptmp");
-                return Builder->CreateUIToFP(L, llvm::Type::getDoubleTy(*TheContext),
-                                             "booltmp");
+                return Builder->CreateFCmpULE(L, R, "cmptmp");
             case lexer::GREATER_TK:
-                L = Builder->CreateFCmpUGT(L, R, "cmptmp");
-                return Builder->CreateUIToFP(L, llvm::Type::getDoubleTy(*TheContext),
-                                             "booltmp");
+                return Builder->CreateFCmpUGT(L, R, "cmptmp");
             case lexer::GREATEEQ_TK:
-                L = Builder->CreateFCmpUGE(L, R, "cmptmp");
-                return Builder->CreateUIToFP(L, llvm::Type::getDoubleTy(*TheContext),
-                                             "booltmp");
+                return Builder->CreateFCmpUGE(L, R, "cmptmp");
             case lexer::EQ_TK:
-                L = Builder->CreateFCmpUEQ(L, R, "cmptmp");
-                return Builder->CreateUIToFP(L, llvm::Type::getDoubleTy(*TheContext),
-                                             "booltmp");
+                return Builder->CreateFCmpUEQ(L, R, "cmptmp");
             case lexer::NOTEQ_TK:
-                L = Builder->CreateFCmpUNE(L, R, "cmptmp");
-                return Builder->CreateUIToFP(L, llvm::Type::getDoubleTy(*TheContext),
-                                             "booltmp");
+                return Builder->CreateFCmpUNE(L, R, "cmptmp");
             default:
                 minilog::log_fatal("can not parse operator: {}", lexer::to_string(op.tok));
                 return nullptr;
         }
     }
     
+    llvm::Value *NotExprAST::codegen() {
+        llvm::Value *C = codegenCond();
+        if (!C)
+            return nullptr;
+        return Builder->CreateUIToFP(C, llvm::Type::getDoubleTy(*TheContext), "booltmp");
+    }
+    
+    llvm::Value *NotExprAST::codegenCond() {
+        llvm::Value *C = operand->codegenCond();
+        if (!C)
+            return nullptr;
+        return Builder->CreateNot(C, "nottmp");
+    }
+    
     llvm::Value *CallExprAST::codegen() {
+        // Calling a struct name constructs a value of that struct, field by field.
+        if (auto SI = StructDecls.find(callee); SI != StructDecls.end()) {
+            llvm::StructType *ST = SI->second->codegen();
+            if (ST->getNumElements() != args.size()) {
+                minilog::log_error("arguments mismatch");
+                return nullptr;
+            }
+            llvm::Value *Agg = llvm::PoisonValue::get(ST);
+            for (unsigned i = 0; i < args.size(); ++i) {
+                llvm::Value *V = args[i]->codegen();
+                if (!V)
+                    return nullptr;
+                if (V->getType() != ST->getElementType(i)) {
+                    minilog::log_error("field {} of {} has the wrong type", SI->second->getFields()[i].name, callee);
+                    return nullptr;
+                }
+                Agg = Builder->CreateInsertValue(Agg, V, i);
+            }
+            return Agg;
+        }
+        
+        // Generic functions are specialized for the argument types of this call.
+        if (auto GI = GenericFuncs.find(callee); GI != GenericFuncs.end()) {
+            std::vector<llvm::Value *> ArgsV;
+            std::vector<llvm::Type *> Types;
+            for (const auto &arg: args) {
+                ArgsV.push_back(arg->codegen());
+                if (!ArgsV.back())
+                    return nullptr;
+                Types.push_back(ArgsV.back()->getType());
+            }
+            llvm::Function *Instance = GI->second->instantiate(Types);
+            if (!Instance)
+                return nullptr;
+            return Builder->CreateCall(Instance, ArgsV, "calltmp");
+        }
+        
         // Look up the name in the global module table.
         llvm::Function *CalleeF = getFunction(callee);
         if (!CalleeF) {
@@ -124,12 +325,12 @@ namespace dust::ast{
         //  Make the function type:  double(double,double) etc.
         std::vector<llvm::Type *> types;
         for(const auto&p:Args){
-            types.push_back(getType(p.typeId));
+            types.push_back(getType(p));
         }
         
         // get the type of function by get, double(double ...)
         llvm::FunctionType *FT = llvm::FunctionType::get(
-                getType(RetType), types, false);
+                getType(RetType, RetTypeName), types, false);
         
         
         // create the function in the specific module
@@ -145,15 +346,11 @@ namespace dust::ast{
     }
     
     
-    
     llvm::Value *IfExprAST::codegen() {
-        llvm::Value *CondV = Cond->codegen();
+        llvm::Value *CondV = Cond->codegenCond();
         if (!CondV)
             return nullptr;
         
-        // Convert condition to a bool by comparing non-equal to 0.0.
-        CondV = Builder->CreateFCmpONE(
-                CondV, llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0)), "ifcond");
         llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
         
         // Create blocks for the then and else cases.  Insert the 'then' block at the
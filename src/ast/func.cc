@@ -4,15 +4,18 @@
 
 #include "ast/func.h"
 #include "parser/parser.h"
+#include "utils/options.h"
 namespace dust::ast{
     using namespace parser;
-    llvm::Function *FunctionAST::codegen() {
-        auto &P = *Proto;
-        FunctionProtos[Proto->getName()] = std::move(Proto);
-        llvm::Function *TheFunction = getFunction(P.getName());
-        if (!TheFunction)
-            return nullptr;
-        
+    
+    // Whether Fn is a tier-0 body of tiered mode, compiled quickly with call
+    // counters and recompiled at O3 once hot. Top-level code is never
+    // recompiled, so it is optimized right away.
+    static bool isTier0(llvm::StringRef Fn) {
+        return Opts.Tiered && Fn != "__anon_expr";
+    }
+    
+    void FunctionAST::codegenBody(llvm::Function *TheFunction) {
         llvm::BasicBlock *EntryBB =
                 llvm::BasicBlock::Create(*TheContext, "entry", TheFunction);
         Builder->SetInsertPoint(EntryBB);
@@ -22,7 +25,7 @@ namespace dust::ast{
             llvm::AllocaInst *Alloca =
                     CreateEntryBlockAlloca(TheFunction,Arg.getType(), std::string{Arg.getName()});
             Builder->CreateStore(&Arg, Alloca);
-            NamedValues[std::string(Arg.getName())] = {Alloca,Arg.getType()};
+            NamedValues.declare(Arg.getName(), {Alloca, Arg.getType()});
         }
         
         // Generate code for each statement in the function body
@@ -38,6 +41,16 @@ namespace dust::ast{
             // If no return statement is encountered, create a default return of void
             Builder->CreateRetVoid();
         }
+    }
+    
+    llvm::Function *FunctionAST::codegen() {
+        auto &P = *Proto;
+        FunctionProtos[P.getName()] = std::make_unique<PrototypeAST>(P);
+        llvm::Function *TheFunction = getFunction(P.getName());
+        if (!TheFunction)
+            return nullptr;
+        
+        codegenBody(TheFunction);
         
         if (verifyFunction(*TheFunction)) {
             TheFunction->eraseFromParent();
@@ -46,8 +59,113 @@ namespace dust::ast{
             return nullptr;
         }
         
-        TheFPM->run(*TheFunction, *TheFAM);
+        if (P.getName() != "__anon_expr")
+            ProfileFunction(*TheFunction);
+        
+        // Otherwise the JIT optimizes it right before compiling it. Tier 0 of
+        // tiered mode is not optimized at all, it only has to be ready fast.
+        if (!TheJIT->optimizesModules() && !isTier0(P.getName()))
+            TheFPM->run(*TheFunction, *TheFAM);
         return TheFunction;
     }
     
-}
\ No newline at end of file
+    llvm::Function *FunctionAST::instantiate(const std::vector<llvm::Type *> &ArgTypes) {
+        auto &Params = Proto->getArgs();
+        if (Params.size() != ArgTypes.size()) {
+            minilog::log_error("arguments mismatch");
+            return nullptr;
+        }
+        
+        // Bind every parameter to the type of its argument, annotated ones must match.
+        std::vector<Variable> Args;
+        std::string Mangled = Proto->getName() + "<";
+        for (size_t i = 0; i < Params.size(); ++i) {
+            auto T = getDustType(ArgTypes[i]);
+            if (!T || (Params[i].typeId != InferredType && getType(Params[i]) != ArgTypes[i])) {
+                minilog::log_error("argument {} of {} has the wrong type", Params[i].name, Proto->getName());
+                return nullptr;
+            }
+            Args.push_back(Variable{Params[i].name, T->typeId, T->typeName});
+            Mangled += (i ? "," : "") + getTypeName(*T);
+        }
+        Mangled += ">";
+        
+        // One instance per signature in each module.
+        if (auto *F = TheModule->getFunction(Mangled))
+            return F;
+        
+        // The return type is annotated, known from an earlier module, or inferred
+        // below from the body, starting out as num.
+        Variable Ret{"", Proto->getRetType(), Proto->getRetTypeName()};
+        bool InferRet = Ret.typeId == InferredType;
+        if (auto RI = InstanceRetTypes.find(Mangled); InferRet && RI != InstanceRetTypes.end()) {
+            Ret = RI->second;
+            InferRet = false;
+        } else if (InferRet) {
+            Ret.typeId = lexer::NUM_TK;
+        }
+        
+        llvm::Function *F = PrototypeAST(Mangled, Args, Ret.typeId, Ret.typeName).codegen();
+        F->setLinkage(llvm::GlobalValue::InternalLinkage);
+        
+        // We are in the middle of emitting the caller, keep its insert point,
+        // locals and generator state. A return in the instance must not finish
+        // the caller's generator, nor destroy the ones the caller iterates.
+        std::string Caller = Builder->GetInsertBlock()->getParent()->getName().str();
+        llvm::IRBuilderBase::InsertPointGuard Guard(*Builder);
+        ScopedSymbolTable CallerValues = std::move(NamedValues);
+        GeneratorState *CallerGenerator = CurGenerator;
+        std::vector<llvm::Value *> CallerOpen = std::move(OpenGenerators);
+        NamedValues.clear();
+        CurGenerator = nullptr;
+        OpenGenerators.clear();
+        codegenBody(F);
+        NamedValues = std::move(CallerValues);
+        CurGenerator = CallerGenerator;
+        OpenGenerators = std::move(CallerOpen);
+        
+        if (InferRet) {
+            llvm::Type *RetTy = nullptr;
+            for (auto &BB: *F) {
+                auto *R = llvm::dyn_cast<llvm::ReturnInst>(BB.getTerminator());
+                if (R && R->getReturnValue()) {
+                    RetTy = R->getReturnValue()->getType();
+                    break;
+                }
+            }
+            if (RetTy && RetTy != F->getReturnType()) {
+                // Recursive calls were already emitted against the num guess.
+                if (!F->use_empty()) {
+                    minilog::log_error("recursive generic function {} needs an explicit return type", Mangled);
+                    F->eraseFromParent();
+                    return nullptr;
+                }
+                auto *NewF = llvm::Function::Create(
+                        llvm::FunctionType::get(RetTy, F->getFunctionType()->params(), false),
+                        llvm::GlobalValue::InternalLinkage, "", TheModule.get());
+                NewF->splice(NewF->end(), F);
+                for (auto [OldArg, NewArg]: llvm::zip(F->args(), NewF->args())) {
+                    NewArg.takeName(&OldArg);
+                    OldArg.replaceAllUsesWith(&NewArg);
+                }
+                NewF->takeName(F);
+                F->eraseFromParent();
+                F = NewF;
+            }
+            if (auto T = getDustType(F->getReturnType()))
+                InstanceRetTypes[Mangled] = *T;
+        }
+        
+        if (verifyFunction(*F)) {
+            F->eraseFromParent();
+            minilog::log_error("function definition error: {}", Mangled);
+            return nullptr;
+        }
+        ProfileFunction(*F);
+        // Compiled along with its caller, and recompiled with it if that tiers up.
+        if (!TheJIT->optimizesModules() && !isTier0(Caller))
+            TheFPM->run(*F, *TheFAM);
+        return F;
+    }
+    
+}
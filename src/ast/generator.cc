@@ -0,0 +1,133 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#include "ast/generator.h"
+#include "parser/parser.h"
+namespace dust::ast{
+    using namespace parser;
+
+    llvm::Type *GeneratorAST::getYieldType() const {
+        return getType(Proto->getRetType(), Proto->getRetTypeName());
+    }
+
+    llvm::Function *GeneratorAST::codegen() {
+        // One instance per module, like a generic fn.
+        if (auto *F = TheModule->getFunction(Proto->getName()))
+            return F;
+
+        // The ramp returns the coroutine handle, an opaque pointer typed like str.
+        llvm::Function *F = PrototypeAST(Proto->getName(), Proto->getArgs(), lexer::STR_TK).codegen();
+        F->setLinkage(llvm::GlobalValue::InternalLinkage);
+        F->setPresplitCoroutine();
+
+        // We may be in the middle of emitting a consumer, keep its state.
+        llvm::IRBuilderBase::InsertPointGuard Guard(*Builder);
+        ScopedSymbolTable CallerValues = std::move(NamedValues);
+        GeneratorState *CallerGenerator = CurGenerator;
+        std::vector<llvm::Value *> CallerOpen = std::move(OpenGenerators);
+        NamedValues.clear();
+        OpenGenerators.clear();
+
+        auto *PtrTy = llvm::PointerType::getUnqual(*TheContext);
+        auto *Int8Ty = llvm::Type::getInt8Ty(*TheContext);
+        llvm::BasicBlock *EntryBB = llvm::BasicBlock::Create(*TheContext, "entry", F);
+        llvm::BasicBlock *AllocBB = llvm::BasicBlock::Create(*TheContext, "coro.alloc", F);
+        llvm::BasicBlock *BeginBB = llvm::BasicBlock::Create(*TheContext, "coro.begin", F);
+        llvm::BasicBlock *FinalBB = llvm::BasicBlock::Create(*TheContext, "coro.final");
+        llvm::BasicBlock *CleanupBB = llvm::BasicBlock::Create(*TheContext, "coro.cleanup");
+        llvm::BasicBlock *FreeBB = llvm::BasicBlock::Create(*TheContext, "coro.free");
+        llvm::BasicBlock *SuspendBB = llvm::BasicBlock::Create(*TheContext, "coro.suspend");
+
+        // The promise holds the last yielded value, the consumer reads it
+        // through llvm.coro.promise with the same alignment.
+        Builder->SetInsertPoint(EntryBB);
+        llvm::Type *YieldTy = getYieldType();
+        llvm::AllocaInst *Promise = Builder->CreateAlloca(YieldTy, nullptr, "promise");
+        Promise->setAlignment(TheModule->getDataLayout().getPrefTypeAlign(YieldTy));
+        llvm::Value *Id = Builder->CreateIntrinsic(
+                llvm::Intrinsic::coro_id, {},
+                {Builder->getInt32(0), Promise, llvm::ConstantPointerNull::get(PtrTy),
+                 llvm::ConstantPointerNull::get(PtrTy)}, nullptr, "id");
+        // Only allocate when CoroElide could not move the frame into the consumer.
+        llvm::Value *NeedAlloc = Builder->CreateIntrinsic(llvm::Intrinsic::coro_alloc, {}, {Id}, nullptr, "need.alloc");
+        Builder->CreateCondBr(NeedAlloc, AllocBB, BeginBB);
+
+        Builder->SetInsertPoint(AllocBB);
+        llvm::Value *Size = Builder->CreateIntrinsic(llvm::Intrinsic::coro_size, {Builder->getInt64Ty()}, {},
+                                                     nullptr, "size");
+        llvm::FunctionCallee Malloc = TheModule->getOrInsertFunction(
+                "malloc", llvm::FunctionType::get(PtrTy, {Builder->getInt64Ty()}, false));
+        llvm::Value *Mem = Builder->CreateCall(Malloc, {Size}, "mem");
+        Builder->CreateBr(BeginBB);
+
+        Builder->SetInsertPoint(BeginBB);
+        llvm::PHINode *Frame = Builder->CreatePHI(PtrTy, 2, "frame");
+        Frame->addIncoming(llvm::ConstantPointerNull::get(PtrTy), EntryBB);
+        Frame->addIncoming(Mem, AllocBB);
+        llvm::Value *Hdl = Builder->CreateIntrinsic(llvm::Intrinsic::coro_begin, {}, {Id, Frame}, nullptr, "hdl");
+
+        for (auto &Arg: F->args()) {
+            llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(F, Arg.getType(), std::string{Arg.getName()});
+            Builder->CreateStore(&Arg, Alloca);
+            NamedValues.declare(Arg.getName(), {Alloca, Arg.getType()});
+        }
+
+        GeneratorState State{Promise, CleanupBB, SuspendBB, FinalBB};
+        CurGenerator = &State;
+        for (const auto &Stmt: Body) {
+            Stmt->codegen();
+            if (Builder->GetInsertBlock()->getTerminator()) {
+                break;
+            }
+        }
+        if (!Builder->GetInsertBlock()->getTerminator()) {
+            Builder->CreateBr(FinalBB);
+        }
+
+        // Running off the end parks the coroutine at its final suspend point,
+        // where llvm.coro.done reports true. It is never resumed from there.
+        F->insert(F->end(), FinalBB);
+        Builder->SetInsertPoint(FinalBB);
+        llvm::Value *Final = Builder->CreateIntrinsic(llvm::Intrinsic::coro_suspend, {},
+                                                      {llvm::ConstantTokenNone::get(*TheContext),
+                                                       Builder->getTrue()}, nullptr, "final");
+        llvm::BasicBlock *TrapBB = llvm::BasicBlock::Create(*TheContext, "coro.trap", F);
+        llvm::SwitchInst *Switch = Builder->CreateSwitch(Final, SuspendBB, 2);
+        Switch->addCase(llvm::ConstantInt::get(Int8Ty, 0), TrapBB);
+        Switch->addCase(llvm::ConstantInt::get(Int8Ty, 1), CleanupBB);
+        Builder->SetInsertPoint(TrapBB);
+        Builder->CreateUnreachable();
+
+        // Destroy frees the frame, unless it was never allocated.
+        F->insert(F->end(), CleanupBB);
+        Builder->SetInsertPoint(CleanupBB);
+        llvm::Value *FreeMem = Builder->CreateIntrinsic(llvm::Intrinsic::coro_free, {}, {Id, Hdl}, nullptr, "mem");
+        Builder->CreateCondBr(Builder->CreateIsNotNull(FreeMem), FreeBB, SuspendBB);
+        F->insert(F->end(), FreeBB);
+        Builder->SetInsertPoint(FreeBB);
+        llvm::FunctionCallee Free = TheModule->getOrInsertFunction(
+                "free", llvm::FunctionType::get(Builder->getVoidTy(), {PtrTy}, false));
+        Builder->CreateCall(Free, {FreeMem});
+        Builder->CreateBr(SuspendBB);
+
+        F->insert(F->end(), SuspendBB);
+        Builder->SetInsertPoint(SuspendBB);
+        Builder->CreateIntrinsic(llvm::Intrinsic::coro_end, {},
+                                 {Hdl, Builder->getFalse(), llvm::ConstantTokenNone::get(*TheContext)});
+        Builder->CreateRet(Hdl);
+
+        NamedValues = std::move(CallerValues);
+        CurGenerator = CallerGenerator;
+        OpenGenerators = std::move(CallerOpen);
+
+        // Not run through TheFPM, the coroutine passes in the module pipeline
+        // split it first (see LowerCoroutines).
+        if (verifyFunction(*F)) {
+            F->eraseFromParent();
+            minilog::log_error("generator definition error: {}", Proto->getName());
+            return nullptr;
+        }
+        return F;
+    }
+}
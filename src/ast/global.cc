@@ -0,0 +1,70 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#include "ast/global.h"
+#include "parser/parser.h"
+namespace dust::ast{
+    using namespace parser;
+
+    bool GlobalVarAST::hasLiteralInit() const {
+        return dynamic_cast<NumberExprAST *>(Init.get()) || dynamic_cast<StringExprAST *>(Init.get());
+    }
+
+    llvm::GlobalVariable *GlobalVarAST::codegen() {
+        llvm::Type *type = getType(Var);
+        llvm::Constant *InitVal;
+        if (auto *Str = dynamic_cast<StringExprAST *>(Init.get())) {
+            InitVal = Builder->CreateGlobalString(Str->getStr(), "string_literal", 0, TheModule.get());
+        } else if (auto *Num = dynamic_cast<NumberExprAST *>(Init.get())) {
+            InitVal = llvm::cast<llvm::Constant>(Num->codegen());
+        } else {
+            // Computed at runtime by the initializer, start out zeroed.
+            InitVal = llvm::Constant::getNullValue(type);
+        }
+        if (InitVal->getType() != type) {
+            minilog::log_error("initializer of {} does not match its type", Var.name);
+            return nullptr;
+        }
+        // Only constants whose value is known here can be marked constant,
+        // the rest are written once by their initializer.
+        return new llvm::GlobalVariable(*TheModule, type, IsConst && hasLiteralInit(),
+                                        llvm::GlobalValue::ExternalLinkage, InitVal, Var.name);
+    }
+
+    llvm::GlobalVariable *GlobalVarAST::codegenDecl() {
+        llvm::Type *type = getType(Var);
+        // Numeric constants carry their value into every user, so loads fold away.
+        if (IsConst && dynamic_cast<NumberExprAST *>(Init.get())) {
+            return new llvm::GlobalVariable(*TheModule, type, true,
+                                            llvm::GlobalValue::AvailableExternallyLinkage,
+                                            llvm::cast<llvm::Constant>(Init->codegen()), Var.name);
+        }
+        return new llvm::GlobalVariable(*TheModule, type, IsConst && hasLiteralInit(),
+                                        llvm::GlobalValue::ExternalLinkage, nullptr, Var.name);
+    }
+
+    llvm::Function *GlobalVarAST::codegenInit() {
+        llvm::FunctionType *FT = llvm::FunctionType::get(getType(lexer::NUM_TK), false);
+        llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage,
+                                                   "__anon_expr", TheModule.get());
+        Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", F));
+        NamedValues.clear();
+
+        llvm::Value *Val = Init->codegen();
+        if (!Val || Val->getType() != getType(Var)) {
+            minilog::log_error("invalid initializer for {}", Var.name);
+            F->eraseFromParent();
+            return nullptr;
+        }
+        Builder->CreateStore(Val, getGlobal(Var.name));
+        Builder->CreateRet(llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0)));
+
+        if (verifyFunction(*F)) {
+            F->eraseFromParent();
+            minilog::log_error("global initializer error");
+            return nullptr;
+        }
+        return F;
+    }
+}
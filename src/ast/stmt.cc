@@ -2,13 +2,35 @@
 // Created by delta on 09/04/2024.
 //
 #include "ast/stmt.h"
+#include "ast/generator.h"
 #include "parser/parser.h"
+#include <set>
 
 namespace dust::ast{
     using namespace parser;
+    // Destroy the generators of every enclosing for-in loop, innermost first.
+    static void destroyOpenGenerators() {
+        for (llvm::Value *Hdl: llvm::reverse(OpenGenerators)) {
+            Builder->CreateIntrinsic(llvm::Intrinsic::coro_destroy, {}, {Hdl});
+        }
+    }
+    
     void ReturnStmtAST::codegen() {
+        if (CurGenerator) {
+            // A generator hands out values with yield, return just finishes it.
+            if (retVal) {
+                minilog::log_error("return in a generator cannot take a value");
+                return;
+            }
+            destroyOpenGenerators();
+            Builder->CreateBr(CurGenerator->Final);
+            return;
+        }
         // Generate code for the return value
         llvm::Value *RetVal = retVal->codegen();
+        if (!RetVal)
+            return;
+        destroyOpenGenerators();
         // Insert return instruction
         Builder->CreateRet(RetVal);
     }
@@ -22,13 +44,10 @@ namespace dust::ast{
     }
     
     void IfStmtAST::codegen() {
-        llvm::Value *CondV = Cond->codegen();
+        llvm::Value *CondV = Cond->codegenCond();
         if (!CondV)
             return;
         
-        // Convert condition to a bool by comparing non-equal to 0.0.
-        CondV = Builder->CreateFCmpONE(
-                CondV, llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0)), "ifcond");
         llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
         
         // Create blocks for the then and else cases.
@@ -86,8 +105,9 @@ namespace dust::ast{
         
         // Store the value into the alloca.
         Builder->CreateStore(StartVal, Alloca);
-        llvm::AllocaInst *OldVal = NamedValues[VarName].first;
-        NamedValues[VarName] = {Alloca,getType(lexer::NUM_TK)};
+        // The induction variable shadows any outer binding until the loop ends.
+        NamedValues.pushScope();
+        NamedValues.declare(VarName, {Alloca, Alloca->getAllocatedType()});
         llvm::Value *StepVal;
         if (Then) {
             StepVal = Then->codegen();
@@ -104,12 +124,11 @@ namespace dust::ast{
                 llvm::BasicBlock::Create(*TheContext, "afterloop", TheFunction);
         Builder->CreateBr(CondBB);
         Builder->SetInsertPoint(CondBB);
-        llvm::Value *CondVal = Cond->codegen();
-        CondVal = Builder->CreateFCmpONE(
-                CondVal,
-                llvm::ConstantFP::get(llvm::Type::getDoubleTy(*TheContext),
-                                      llvm::APFloat(0.0)),
-                "loopcond");
+        llvm::Value *CondVal = Cond->codegenCond();
+        if (!CondVal) {
+            NamedValues.popScope();
+            return;
+        }
         
         Builder->CreateCondBr(CondVal, LoopBB, AfterBB);
         
@@ -133,20 +152,79 @@ namespace dust::ast{
         // Any new code will be inserted in AfterBB.
         Builder->SetInsertPoint(AfterBB);
         // Restore the unshadowed variable.
-        if (OldVal) {
-            NamedValues[VarName] = {OldVal,getType(lexer::NUM_TK)};
-        } else {
-            NamedValues.erase(VarName);
+        NamedValues.popScope();
+    }
+    
+    void MatchStmtAST::codegen() {
+        std::set<int64_t> Seen;
+        for (const auto &Case: Cases) {
+            for (int64_t Label: Case.Labels) {
+                if (!Seen.insert(Label).second) {
+                    minilog::log_error("duplicate match label: {}", Label);
+                    return;
+                }
+            }
+        }
+        llvm::Value *V = Val->codegen();
+        if (!V)
+            return;
+        
+        llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock *SwitchBB = llvm::BasicBlock::Create(*TheContext, "dispatch", TheFunction);
+        llvm::BasicBlock *DefaultBB = llvm::BasicBlock::Create(*TheContext, "default");
+        llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(*TheContext, "aftermatch");
+        
+        // Labels are integers, so only a value that converts to i64 exactly can hit one.
+        // The saturating conversion keeps NaN and out of range values well defined.
+        llvm::Type *IntTy = llvm::Type::getInt64Ty(*TheContext);
+        llvm::Value *IntV = Builder->CreateIntrinsic(llvm::Intrinsic::fptosi_sat, {IntTy, V->getType()}, {V},
+                                                     nullptr, "matchval");
+        llvm::Value *Exact = Builder->CreateFCmpOEQ(Builder->CreateSIToFP(IntV, V->getType()), V, "matchexact");
+        Builder->CreateCondBr(Exact, SwitchBB, DefaultBB);
+        
+        Builder->SetInsertPoint(SwitchBB);
+        llvm::SwitchInst *Switch = Builder->CreateSwitch(IntV, DefaultBB, Cases.size());
+        for (const auto &Case: Cases) {
+            llvm::BasicBlock *CaseBB = llvm::BasicBlock::Create(*TheContext, "case", TheFunction);
+            for (int64_t Label: Case.Labels) {
+                Switch->addCase(llvm::ConstantInt::get(llvm::cast<llvm::IntegerType>(IntTy), Label, true), CaseBB);
+            }
+            Builder->SetInsertPoint(CaseBB);
+            for (const auto &stmt: Case.Body) {
+                stmt->codegen();
+                // Check if there's already a terminator instruction, if so, don't generate code for the remaining statements.
+                if (Builder->GetInsertBlock()->getTerminator()) {
+                    break;
+                }
+            }
+            if (!Builder->GetInsertBlock()->getTerminator()) {
+                Builder->CreateBr(MergeBB);
+            }
+        }
+        
+        // Emit the default block, an empty one just falls through.
+        TheFunction->insert(TheFunction->end(), DefaultBB);
+        Builder->SetInsertPoint(DefaultBB);
+        for (const auto &stmt: Default) {
+            stmt->codegen();
+            if (Builder->GetInsertBlock()->getTerminator()) {
+                break;
+            }
         }
+        if (!Builder->GetInsertBlock()->getTerminator()) {
+            Builder->CreateBr(MergeBB);
+        }
+        
+        TheFunction->insert(TheFunction->end(), MergeBB);
+        Builder->SetInsertPoint(MergeBB);
     }
     
     void VarStmtAST::codegen() {
-        std::vector<std::pair<llvm::AllocaInst *,llvm::Type*>> OldBindings;
-        
         llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
         llvm::BasicBlock* VarBB=llvm::BasicBlock::Create(*TheContext,"varBB",TheFunction);
         Builder->CreateBr(VarBB);
         Builder->SetInsertPoint(VarBB);
+        NamedValues.pushScope();
         // Register all variables and emit their initializer.
         for (const auto &p: vars) {
             auto & Var=p.first;
@@ -155,22 +233,24 @@ namespace dust::ast{
             
             // Emit the initializer before adding the variable to scope, this prevents
             // the initializer from referencing the variable itself, and permits stuff
+            llvm::Type* type= getType(Var);
             llvm::Value *InitVal;
             if (Init) {
                 InitVal = Init->codegen();
-            } else { // If not specified, use 0.0.
-                InitVal = llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0));
+            } else { // If not specified, use 0.0 (or all fields zeroed).
+                InitVal = llvm::Constant::getNullValue(type);
+            }
+            if (!InitVal || InitVal->getType() != type) {
+                if (InitVal)
+                    minilog::log_error("initializer of {} does not match its type", Var.name);
+                NamedValues.popScope();
+                return;
             }
-            llvm::Type* type= getType(Var.typeId);
             llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction,type, Var.name);
             Builder->CreateStore(InitVal, Alloca);
             
-            // Remember the old variable binding so that we can restore the binding when
-            // we unrecurse.
-            OldBindings.emplace_back(NamedValues[ Var.name].first,type);
-            
-            // Remember this binding.
-            NamedValues[ Var.name] = {Alloca,type};
+            // Remember this binding, it shadows any outer one until the scope is popped.
+            NamedValues.declare(Var.name, {Alloca, type});
         }
         
         // Codegen the body, now that all vars are in scope.
@@ -181,7 +261,114 @@ namespace dust::ast{
             }
         }
         // Pop all our variables from scope.
-        for (unsigned i = 0, e = vars.size(); i != e; ++i)
-            NamedValues[vars[i].first.name] = OldBindings[i];
+        NamedValues.popScope();
+    }
+    
+    void YieldStmtAST::codegen() {
+        if (!CurGenerator) {
+            minilog::log_error("yield outside of a generator");
+            return;
+        }
+        llvm::Value *V = Val->codegen();
+        if (!V)
+            return;
+        if (V->getType() != CurGenerator->Promise->getAllocatedType()) {
+            minilog::log_error("yielded value does not match the type of the generator");
+            return;
+        }
+        Builder->CreateStore(V, CurGenerator->Promise);
+        llvm::Value *S = Builder->CreateIntrinsic(llvm::Intrinsic::coro_suspend, {},
+                                                  {llvm::ConstantTokenNone::get(*TheContext), Builder->getFalse()},
+                                                  nullptr, "yield");
+        
+        llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock *ResumeBB = llvm::BasicBlock::Create(*TheContext, "resume", TheFunction);
+        llvm::BasicBlock *DestroyBB = CurGenerator->Cleanup;
+        if (!OpenGenerators.empty()) {
+            // Destroyed while suspended inside for-in loops of its own.
+            DestroyBB = llvm::BasicBlock::Create(*TheContext, "destroy", TheFunction);
+        }
+        // llvm.coro.suspend returns 0 when resumed and 1 when destroyed.
+        llvm::SwitchInst *Switch = Builder->CreateSwitch(S, CurGenerator->Suspend, 2);
+        Switch->addCase(Builder->getInt8(0), ResumeBB);
+        Switch->addCase(Builder->getInt8(1), DestroyBB);
+        if (DestroyBB != CurGenerator->Cleanup) {
+            Builder->SetInsertPoint(DestroyBB);
+            destroyOpenGenerators();
+            Builder->CreateBr(CurGenerator->Cleanup);
+        }
+        Builder->SetInsertPoint(ResumeBB);
+    }
+    
+    void ForInStmtAST::codegen() {
+        auto GI = Generators.find(Gen);
+        if (GI == Generators.end()) {
+            minilog::log_error("unknown generator: {}", Gen);
+            return;
+        }
+        auto &G = *GI->second;
+        auto &Params = G.getProto().getArgs();
+        if (Params.size() != Args.size()) {
+            minilog::log_error("arguments mismatch");
+            return;
+        }
+        std::vector<llvm::Value *> ArgsV;
+        for (size_t i = 0; i < Args.size(); ++i) {
+            llvm::Value *V = Args[i]->codegen();
+            if (!V)
+                return;
+            if (V->getType() != getType(Params[i])) {
+                minilog::log_error("argument {} of {} has the wrong type", Params[i].name, Gen);
+                return;
+            }
+            ArgsV.push_back(V);
+        }
+        llvm::Function *Ramp = G.codegen();
+        if (!Ramp)
+            return;
+        
+        llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+        llvm::Type *YieldTy = G.getYieldType();
+        llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, YieldTy, VarName);
+        
+        // The ramp runs the generator up to its first yield.
+        llvm::Value *Hdl = Builder->CreateCall(Ramp, ArgsV, "gen");
+        llvm::BasicBlock *CondBB = llvm::BasicBlock::Create(*TheContext, "cond", TheFunction);
+        llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(*TheContext, "loop", TheFunction);
+        llvm::BasicBlock *AfterBB = llvm::BasicBlock::Create(*TheContext, "afterloop", TheFunction);
+        Builder->CreateBr(CondBB);
+        
+        // It is done once parked at its final suspend point.
+        Builder->SetInsertPoint(CondBB);
+        llvm::Value *Done = Builder->CreateIntrinsic(llvm::Intrinsic::coro_done, {}, {Hdl}, nullptr, "done");
+        Builder->CreateCondBr(Done, AfterBB, LoopBB);
+        
+        Builder->SetInsertPoint(LoopBB);
+        llvm::Align PromiseAlign = TheModule->getDataLayout().getPrefTypeAlign(YieldTy);
+        llvm::Value *Promise = Builder->CreateIntrinsic(
+                llvm::Intrinsic::coro_promise, {},
+                {Hdl, Builder->getInt32(PromiseAlign.value()), Builder->getFalse()}, nullptr, "promise");
+        Builder->CreateStore(Builder->CreateLoad(YieldTy, Promise, VarName), Alloca);
+        NamedValues.pushScope();
+        NamedValues.declare(VarName, {Alloca, YieldTy});
+        // A return inside the body must destroy the generator, see ReturnStmtAST.
+        OpenGenerators.push_back(Hdl);
+        for (const auto &stmt: Body) {
+            stmt->codegen();
+            if (Builder->GetInsertBlock()->getTerminator()) {
+                break;
+            }
+        }
+        if (!Builder->GetInsertBlock()->getTerminator()) {
+            Builder->CreateIntrinsic(llvm::Intrinsic::coro_resume, {}, {Hdl});
+            Builder->CreateBr(CondBB);
+        }
+        OpenGenerators.pop_back();
+        NamedValues.popScope();
+        
+        // Every path out of the loop destroys the frame, which lets CoroElide
+        // allocate it on this function's stack once the ramp is inlined.
+        Builder->SetInsertPoint(AfterBB);
+        Builder->CreateIntrinsic(llvm::Intrinsic::coro_destroy, {}, {Hdl});
     }
-}
\ No newline at end of file
+}
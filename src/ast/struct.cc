@@ -0,0 +1,28 @@
+//
+// Created by delta on 19/10/2026.
+//
+
+#include "ast/struct.h"
+#include "parser/parser.h"
+namespace dust::ast{
+    using namespace parser;
+
+    int StructAST::getFieldIndex(const std::string &Field) const {
+        for (size_t i = 0; i < Fields.size(); ++i) {
+            if (Fields[i].name == Field)
+                return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    llvm::StructType *StructAST::codegen() {
+        // Every module has its own context, so the type is created once per context.
+        if (auto *ST = llvm::StructType::getTypeByName(*TheContext, Name))
+            return ST;
+        std::vector<llvm::Type *> types;
+        for (const auto &F: Fields) {
+            types.push_back(getType(F));
+        }
+        return llvm::StructType::create(*TheContext, types, Name);
+    }
+}
@@ -1,3 +1,299 @@
 //
 // Created by delta on 12/04/2024.
 //
+
+#include "code/gen.h"
+#include "code/snapshot.h"
+#include "code/unit.h"
+#include "parser/parser.h"
+#include "utils/options.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/TargetParser/Host.h"
+#include "llvm/TargetParser/Triple.h"
+#include <filesystem>
+#include <fstream>
+
+// Set by CMake to the static library built from lib/print.cc.
+#ifndef DUST_RUNTIME_LIB
+#define DUST_RUNTIME_LIB "dustrt"
+#endif
+
+namespace dust::code{
+    using namespace parser;
+    namespace fs = std::filesystem;
+
+    static std::string defaultOutputPath(const llvm::Triple &Triple) {
+        fs::path Out = fs::path(Opts.Source).filename();
+        bool Win = Triple.isOSWindows();
+        switch (Opts.Output) {
+            case Options::OutputKind::Object:
+                return Out.replace_extension(Win ? ".obj" : ".o").string();
+            case Options::OutputKind::Shared:
+                return Out.replace_extension(Win ? ".dll" : ".so").string();
+            default:
+                return Out.replace_extension(Win ? ".exe" : "").string();
+        }
+    }
+
+    // <stem of the output>_init, so several dust objects can be linked together.
+    static std::string initName(const std::string &OutputPath) {
+        std::string Name = fs::path(OutputPath).stem().string();
+        for (auto &C: Name) {
+            if (!std::isalnum(static_cast<unsigned char>(C)))
+                C = '_';
+        }
+        if (Name.empty() || std::isdigit(static_cast<unsigned char>(Name.front())))
+            Name.insert(0, "_");
+        return Name + "_init";
+    }
+
+    // Parse the whole file into TheModule. Returns the functions running the
+    // top-level statements and global initializers, in source order. The tokens
+    // of generic fns and generators, which have no code of their own, are
+    // added to Templates.
+    static std::vector<llvm::Function *> compileSource(std::vector<TokenRange> &Templates) {
+        std::vector<llvm::Function *> InitSteps;
+        auto AddStep = [&](llvm::Function *F) {
+            // Frees the __anon_expr name for the next one, and lets the steps
+            // be inlined into the init function.
+            F->setName("__dust_init_step");
+            F->setLinkage(llvm::GlobalValue::InternalLinkage);
+            InitSteps.push_back(F);
+        };
+        PrefetchImports();
+        while (GetToken().tok != lexer::EOF_TK) {
+            size_t Begin = lexer::tokIndex;
+            if (GetToken().tok == lexer::FN_TK) {
+                CompileFuncDef();
+                if (Begin + 1 < lexer::tokIndex && GenericFuncs.contains(lexer::tokens[Begin + 1].val))
+                    Templates.emplace_back(Begin, lexer::tokIndex);
+            } else if (GetToken().tok == lexer::EXTERN_TK) {
+                CompileExtern();
+            } else if (GetToken().tok == lexer::IMPORT_TK) {
+                CompileImport();
+            } else if (GetToken().tok == lexer::VAR_TK || GetToken().tok == lexer::CONST_TK) {
+                for (auto *F: CompileGlobalVar())
+                    AddStep(F);
+            } else if (GetToken().tok == lexer::STRUCT_TK) {
+                InterpretStruct();
+            } else if (GetToken().tok == lexer::GEN_TK) {
+                InterpretGenDef();
+                Templates.emplace_back(Begin, lexer::tokIndex);
+            } else if (auto *F = CompileTopLevelExpr()) {
+                AddStep(F);
+            }
+        }
+        return InitSteps;
+    }
+
+    // The C spelling of a dust parameter or return type, empty if C can not
+    // pass it the way the generated code does (structs are first-class aggregates).
+    static std::string cType(const Variable &V) {
+        if (V.typeId == lexer::NUM_TK)
+            return "double";
+        if (V.typeId == lexer::STR_TK)
+            return "const char *";
+        return "";
+    }
+
+    static bool writeHeader(const std::string &Path, const std::string &Init,
+                            const std::vector<llvm::Function *> &Exported) {
+        std::ofstream H(Path);
+        std::string Guard = fs::path(Path).filename().string();
+        for (auto &C: Guard)
+            C = std::isalnum(static_cast<unsigned char>(C)) ? static_cast<char>(std::toupper(C)) : '_';
+        H << "// Generated by dust from " << fs::path(Opts.Source).filename().string() << ", do not edit.\n"
+          << "#ifndef " << Guard << "\n#define " << Guard << "\n\n"
+          << "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n"
+          << "// Runs the top-level statements, call it once before anything else.\n"
+          << "void " << Init << "(void);\n\n";
+        for (auto *F: Exported) {
+            auto &Proto = *FunctionProtos[F->getName().str()];
+            std::string Decl = F->getReturnType()->isVoidTy()
+                               ? "void"
+                               : cType(Variable{"", Proto.getRetType(), Proto.getRetTypeName()});
+            if (Decl.empty()) {
+                H << "// " << F->getName().str() << " returns a struct, it is not callable from C.\n";
+                continue;
+            }
+            Decl += " " + F->getName().str() + "(";
+            for (size_t i = 0; i < F->arg_size(); ++i) {
+                std::string Arg = cType(Proto.getArgs()[i]);
+                if (Arg.empty()) {
+                    Decl.clear();
+                    break;
+                }
+                Decl += (i ? ", " : "") + Arg + (Arg.ends_with('*') ? "" : " ") + Proto.getArgs()[i].name;
+            }
+            if (Decl.empty()) {
+                H << "// " << F->getName().str() << " takes a struct, it is not callable from C.\n";
+                continue;
+            }
+            H << Decl << (F->arg_empty() ? "void);\n" : ");\n");
+        }
+        H << "\n#ifdef __cplusplus\n}\n#endif\n\n#endif\n";
+        return static_cast<bool>(H);
+    }
+
+    static bool emitObject(llvm::TargetMachine &TM, llvm::raw_pwrite_stream &Out) {
+        llvm::legacy::PassManager PM;
+        if (TM.addPassesToEmitFile(PM, Out, nullptr, llvm::CodeGenFileType::ObjectFile)) {
+            minilog::log_error("the target can not emit object files");
+            return false;
+        }
+        PM.run(*TheModule);
+        Out.flush();
+        return true;
+    }
+
+    static bool emitObject(llvm::TargetMachine &TM, const std::string &Path) {
+        std::error_code EC;
+        llvm::raw_fd_ostream Out(Path, EC, llvm::sys::fs::OF_None);
+        if (EC) {
+            minilog::log_error("can not open {}: {}", Path, EC.message());
+            return false;
+        }
+        return emitObject(TM, Out);
+    }
+
+    // Link Obj with the runtime through the system C++ driver, which knows
+    // where the C and C++ libraries the runtime needs are.
+    static bool link(const std::string &Obj, const std::string &Out) {
+        auto Driver = llvm::sys::findProgramByName("clang++");
+        if (!Driver)
+            Driver = llvm::sys::findProgramByName("c++");
+        if (!Driver) {
+            minilog::log_error("no C++ compiler found to link {}", Out);
+            return false;
+        }
+        std::vector<llvm::StringRef> Args{*Driver, Obj, DUST_RUNTIME_LIB, "-o", Out};
+        if (Opts.Output == Options::OutputKind::Shared)
+            Args.push_back("-shared");
+        std::string ErrMsg;
+        int Ret = llvm::sys::ExecuteAndWait(*Driver, Args, std::nullopt, {}, 0, 0, &ErrMsg);
+        if (Ret != 0) {
+            minilog::log_error("linking {} failed: {}", Out, ErrMsg.empty() ? std::to_string(Ret) : ErrMsg);
+            return false;
+        }
+        return true;
+    }
+
+    int CompileProgram() {
+        bool Snapshot = Opts.Output == Options::OutputKind::Snapshot;
+        std::unique_ptr<llvm::TargetMachine> TM;
+        if (Snapshot) {
+            // Linked into the JIT of a later run on this machine, compile as the JIT would.
+            TM = ExitOnErr(TheJIT->createTargetMachine());
+        } else {
+            std::string TripleStr = llvm::sys::getDefaultTargetTriple();
+            std::string Err;
+            auto *Target = llvm::TargetRegistry::lookupTarget(TripleStr, Err);
+            if (!Target) {
+                minilog::log_error("{}", Err);
+                return 1;
+            }
+            // Generic CPU, the output may run on other machines than this one. Always
+            // position independent, so the same code serves shared libraries.
+            TM.reset(Target->createTargetMachine(TripleStr, "generic", "", llvm::TargetOptions(),
+                                                 llvm::Reloc::PIC_));
+        }
+        const llvm::Triple &Triple = TM->getTargetTriple();
+        TheModule->setTargetTriple(Triple.str());
+        TheModule->setDataLayout(TM->createDataLayout());
+
+        std::string OutputPath = Opts.OutputPath.empty() ? defaultOutputPath(Triple) : Opts.OutputPath;
+        std::vector<TokenRange> Templates;
+        unsigned Errors = minilog::error_count();
+        std::vector<llvm::Function *> InitSteps = compileSource(Templates);
+        // The items that failed are missing, the output would be incomplete.
+        if (minilog::error_count() != Errors)
+            return 1;
+
+        // Everything the source defined is part of the library's interface.
+        std::vector<llvm::Function *> Exported;
+        for (auto &F: *TheModule) {
+            if (!F.isDeclaration() && F.hasExternalLinkage() && FunctionProtos.contains(F.getName().str()))
+                Exported.push_back(&F);
+        }
+
+        std::string Init = Snapshot ? SnapshotInit.str() : initName(OutputPath);
+        // LLVM would rename the entry points silently, leaving the fn in their place.
+        std::vector<std::string> Entries{Init};
+        if (Opts.Output == Options::OutputKind::Executable)
+            Entries.emplace_back("main");
+        for (const auto &Entry: Entries) {
+            if (TheModule->getNamedValue(Entry)) {
+                minilog::log_error("{} is the entry point of the output, rename the fn", Entry);
+                return 1;
+            }
+        }
+        auto *InitFn = llvm::Function::Create(llvm::FunctionType::get(Builder->getVoidTy(), false),
+                                              llvm::GlobalValue::ExternalLinkage, Init, TheModule.get());
+        Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", InitFn));
+        if (!Opts.ProfileGenerate.empty())
+            EmitProfileRegistration();
+        for (auto *F: InitSteps)
+            Builder->CreateCall(F);
+        Builder->CreateRetVoid();
+
+        if (Opts.Output == Options::OutputKind::Executable) {
+            auto *Main = llvm::Function::Create(llvm::FunctionType::get(Builder->getInt32Ty(), false),
+                                                llvm::GlobalValue::ExternalLinkage, "main", TheModule.get());
+            Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", Main));
+            Builder->CreateCall(InitFn);
+            Builder->CreateRet(Builder->getInt32(0));
+        } else if (Snapshot) {
+            // Named like the first body of a JIT'd fn, the stub Name is made on
+            // load. Calls within the snapshot go straight to the bodies.
+            for (auto *F: Exported)
+                F->setName(F->getName() + "$1");
+        } else if (Opts.Output == Options::OutputKind::Shared && Triple.isOSWindows()) {
+            for (auto *F: Exported)
+                F->setDLLStorageClass(llvm::GlobalValue::DLLExportStorageClass);
+            InitFn->setDLLStorageClass(llvm::GlobalValue::DLLExportStorageClass);
+        }
+
+        if (llvm::verifyModule(*TheModule, &llvm::errs())) {
+            minilog::log_error("invalid module");
+            return 1;
+        }
+        // Also splits the generators and inlines the init steps.
+        OptimizeModule(*TheModule, llvm::OptimizationLevel::O2);
+
+        if (Snapshot) {
+            llvm::SmallVector<char, 0> Obj;
+            llvm::raw_svector_ostream OS(Obj);
+            if (!emitObject(*TM, OS) || !WriteSnapshot(OutputPath, {Obj.data(), Obj.size()}, Templates))
+                return 1;
+            return 0;
+        }
+        if (Opts.Output == Options::OutputKind::Object) {
+            if (!emitObject(*TM, OutputPath))
+                return 1;
+        } else {
+            llvm::SmallString<128> Obj;
+            if (auto EC = llvm::sys::fs::createTemporaryFile("dust", Triple.isOSWindows() ? "obj" : "o", Obj)) {
+                minilog::log_error("can not create a temporary file: {}", EC.message());
+                return 1;
+            }
+            bool Ok = emitObject(*TM, Obj.str().str()) && link(Obj.str().str(), OutputPath);
+            llvm::sys::fs::remove(Obj);
+            if (!Ok)
+                return 1;
+        }
+
+        if (Opts.Output != Options::OutputKind::Executable) {
+            std::string HeaderPath = fs::path(OutputPath).replace_extension(".h").string();
+            if (!writeHeader(HeaderPath, Init, Exported)) {
+                minilog::log_error("can not write {}", HeaderPath);
+                return 1;
+            }
+        }
+        return 0;
+    }
+}
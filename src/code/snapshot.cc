@@ -0,0 +1,401 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "code/snapshot.h"
+#include "parser/parser.h"
+#include "utils/options.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <algorithm>
+#include <format>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+namespace dust::code{
+    using namespace parser;
+
+    // The image: "DUSTIMG <version> <target id> <table size> <object size>\n", the
+    // table, zeros up to the next 16 bytes, the object. The table is text, one
+    // entry per line:
+    //   source <bytes>, the file it was compiled from
+    //   struct <name> <fields>, then a variable per field
+    //   fn|extern <name> <args> <return type id> <return type name>, then a variable per arg
+    //   var <variable> <const> none|computed|num <value>|str <bytes>
+    //   tokens <count>, then <token id> <bytes> per token
+    //   import <bytes>, the image of a unit the session imported
+    // with variables as <name> <type id> <type name>, "-" for an empty name, and
+    // <bytes> as <length> <raw bytes>.
+    static constexpr llvm::StringLiteral Magic = "DUSTIMG";
+
+    static std::string word(const std::string &S) { return S.empty() ? "-" : S; }
+
+    static std::string unword(const std::string &S) { return S == "-" ? "" : S; }
+
+    static void writeVariable(std::ostream &Out, const Variable &V) {
+        Out << word(V.name) << " " << V.typeId << " " << word(V.typeName);
+    }
+
+    static bool readVariable(std::istream &In, Variable &V) {
+        std::string Name, TypeName;
+        int TypeId = 0;
+        if (!(In >> Name >> TypeId >> TypeName))
+            return false;
+        V = {unword(Name), static_cast<lexer::TokenId>(TypeId), unword(TypeName)};
+        return true;
+    }
+
+    static void writeBytes(std::ostream &Out, const std::string &S) {
+        Out << S.size() << " " << S;
+    }
+
+    static bool readBytes(std::istream &In, std::string &S) {
+        size_t Len = 0;
+        if (!(In >> Len) || In.get() != ' ')
+            return false;
+        S.resize(Len);
+        return static_cast<bool>(In.read(S.data(), static_cast<std::streamsize>(Len)));
+    }
+
+    std::string CompilerId() {
+        std::string Exe = llvm::sys::fs::getMainExecutable(nullptr, reinterpret_cast<void *>(&CompilerId));
+        llvm::sys::fs::file_status Status;
+        if (llvm::sys::fs::status(Exe, Status))
+            return Exe;
+        return std::format("{} {} {}", Exe, Status.getSize(),
+                           Status.getLastModificationTime().time_since_epoch().count());
+    }
+
+    // The images of the units imported by the session being compiled.
+    static thread_local std::vector<std::string> Imported;
+
+    bool WriteSnapshot(const std::string &Path, llvm::StringRef Obj, const std::vector<TokenRange> &Templates) {
+        std::ostringstream Table;
+        Table << "source ";
+        writeBytes(Table, Opts.Source);
+        Table << "\n";
+        // First, they are loaded before the code referring to them.
+        for (const auto &Image: Imported) {
+            Table << "import ";
+            writeBytes(Table, Image);
+            Table << "\n";
+        }
+        for (const auto &[Name, S]: StructDecls) {
+            Table << "struct " << Name << " " << S->getFields().size() << "\n";
+            for (const auto &F: S->getFields()) {
+                writeVariable(Table, F);
+                Table << "\n";
+            }
+        }
+        for (const auto &[Name, P]: FunctionProtos) {
+            if (Name == "__anon_expr")
+                continue;
+            // Bodies were renamed to Name$1 by CompileProgram, the rest are externs.
+            auto *F = TheModule->getFunction(Name + "$1");
+            Table << (F && !F->isDeclaration() ? "fn " : "extern ") << Name << " " << P->getArgs().size() << " "
+                  << P->getRetType() << " " << word(P->getRetTypeName()) << "\n";
+            for (const auto &A: P->getArgs()) {
+                writeVariable(Table, A);
+                Table << "\n";
+            }
+        }
+        for (const auto &[Name, G]: GlobalVars) {
+            Table << "var ";
+            writeVariable(Table, G->getVar());
+            Table << " " << G->isConst() << " ";
+            if (auto *Num = dynamic_cast<NumberExprAST *>(G->getInit())) {
+                Table << std::format("num {}", Num->getVal());
+            } else if (auto *Str = dynamic_cast<StringExprAST *>(G->getInit())) {
+                Table << "str ";
+                writeBytes(Table, Str->getStr());
+            } else {
+                // Its value is in the object, set by the init function.
+                Table << (G->hasInit() ? "computed" : "none");
+            }
+            Table << "\n";
+        }
+        size_t Count = 0;
+        for (auto [Begin, End]: Templates)
+            Count += End - Begin;
+        Table << "tokens " << Count << "\n";
+        for (auto [Begin, End]: Templates) {
+            for (size_t i = Begin; i < End; ++i) {
+                Table << lexer::tokens[i].tok << " ";
+                writeBytes(Table, lexer::tokens[i].val);
+                Table << "\n";
+            }
+        }
+
+        std::string TableStr = Table.str();
+        std::string Header = std::format("{} {} {} {} {}\n", Magic.str(), ImageVersion, TheJIT->getTargetId(),
+                                         TableStr.size(), Obj.size());
+        // Aligned, the object is linked in place from the mapped image.
+        size_t Padding = llvm::alignTo(Header.size() + TableStr.size(), 16) - Header.size() - TableStr.size();
+        std::ofstream Out(Path, std::ios::binary);
+        Out << Header << TableStr << std::string(Padding, '\0');
+        Out.write(Obj.data(), static_cast<std::streamsize>(Obj.size()));
+        if (!Out) {
+            minilog::log_error("can not write snapshot {}", Path);
+            return false;
+        }
+        return true;
+    }
+
+    // An image read by openImage, its table is declared to the parser by
+    // declareImage.
+    struct Image {
+        std::unique_ptr<llvm::MemoryBuffer> File;
+        llvm::StringRef Obj;
+        // the fns with a body in Obj
+        std::vector<std::string> Defined;
+        std::vector<std::string> Imports;
+        std::string Source;
+        std::map<std::string, std::unique_ptr<StructAST>> Structs;
+        std::map<std::string, std::unique_ptr<PrototypeAST>> Protos;
+        std::map<std::string, std::unique_ptr<GlobalVarAST>> Globals;
+        // of the templates
+        std::vector<lexer::Token> Tokens;
+    };
+
+    static bool readTable(std::istream &In, Image &I) {
+        std::string Tag;
+        while (In >> Tag) {
+            if (Tag == "source") {
+                if (!readBytes(In, I.Source))
+                    return false;
+            } else if (Tag == "import") {
+                if (!readBytes(In, I.Imports.emplace_back()))
+                    return false;
+            } else if (Tag == "struct" || Tag == "fn" || Tag == "extern") {
+                std::string Name, RetName;
+                size_t N = 0;
+                int RetId = 0;
+                if (!(In >> Name >> N) || (Tag != "struct" && !(In >> RetId >> RetName)))
+                    return false;
+                std::vector<Variable> Vars(N);
+                for (auto &V: Vars) {
+                    if (!readVariable(In, V))
+                        return false;
+                }
+                if (Tag == "struct") {
+                    I.Structs[Name] = std::make_unique<StructAST>(Name, std::move(Vars));
+                    continue;
+                }
+                I.Protos[Name] = std::make_unique<PrototypeAST>(Name, std::move(Vars),
+                                                                static_cast<lexer::TokenId>(RetId),
+                                                                unword(RetName));
+                if (Tag == "fn")
+                    I.Defined.push_back(Name);
+            } else if (Tag == "var") {
+                Variable V;
+                bool IsConst = false;
+                std::string Kind;
+                if (!readVariable(In, V) || !(In >> IsConst >> Kind))
+                    return false;
+                // Computed values are set by the snapshot's init function, only
+                // literals are kept, codegenDecl folds numeric constants into their users.
+                std::unique_ptr<ExprAST> Init;
+                if (Kind == "num") {
+                    double Val = 0;
+                    if (!(In >> Val))
+                        return false;
+                    Init = std::make_unique<NumberExprAST>(Val);
+                } else if (Kind == "str") {
+                    std::string Str;
+                    if (!readBytes(In, Str))
+                        return false;
+                    Init = std::make_unique<StringExprAST>(std::move(Str));
+                } else if (Kind != "computed" && Kind != "none") {
+                    return false;
+                }
+                I.Globals[V.name] = std::make_unique<GlobalVarAST>(V, IsConst, std::move(Init));
+            } else if (Tag == "tokens") {
+                size_t Count = 0;
+                if (!(In >> Count))
+                    return false;
+                I.Tokens.resize(Count);
+                for (auto &T: I.Tokens) {
+                    int Id = 0;
+                    if (!(In >> Id) || !readBytes(In, T.val))
+                        return false;
+                    T.tok = static_cast<lexer::TokenId>(Id);
+                }
+            } else {
+                return false;
+            }
+        }
+        return In.eof();
+    }
+
+    // Map the image at Path and read its table.
+    static bool openImage(const std::string &Path, Image &I) {
+        // Mapped rather than read, the object is linked straight out of it.
+        auto Buffer = llvm::MemoryBuffer::getFile(Path, false, false);
+        if (!Buffer) {
+            minilog::log_error("can not read snapshot {}: {}", Path, Buffer.getError().message());
+            return false;
+        }
+        I.File = std::move(*Buffer);
+        llvm::StringRef Data = I.File->getBuffer();
+
+        size_t HeaderEnd = Data.find('\n');
+        std::istringstream Header(Data.substr(0, HeaderEnd).str());
+        std::string Tag, Target;
+        unsigned Version = 0;
+        size_t TableSize = 0, ObjSize = 0;
+        if (HeaderEnd == llvm::StringRef::npos || !(Header >> Tag >> Version) || Tag != Magic) {
+            minilog::log_error("{} is not a dust snapshot", Path);
+            return false;
+        }
+        if (Version != ImageVersion) {
+            minilog::log_error("snapshot {} has format {}, this dust reads {}", Path, Version, ImageVersion);
+            return false;
+        }
+        if (!(Header >> Target >> TableSize >> ObjSize)) {
+            minilog::log_error("malformed snapshot {}", Path);
+            return false;
+        }
+        // Native code, only for the machine it was compiled for.
+        if (Target != TheJIT->getTargetId()) {
+            minilog::log_error("snapshot {} was compiled for {}, not {}", Path, Target, TheJIT->getTargetId());
+            return false;
+        }
+        size_t TableBegin = HeaderEnd + 1;
+        size_t ObjBegin = llvm::alignTo(TableBegin + TableSize, 16);
+        if (ObjBegin + ObjSize > Data.size()) {
+            minilog::log_error("snapshot {} is truncated", Path);
+            return false;
+        }
+        I.Obj = Data.substr(ObjBegin, ObjSize);
+
+        std::istringstream Table(Data.substr(TableBegin, TableSize).str());
+        if (!readTable(Table, I)) {
+            minilog::log_error("malformed snapshot {}", Path);
+            return false;
+        }
+        return true;
+    }
+
+    // Declare what the image I at Path holds to the parser. Only once it is
+    // accepted, nothing undoes it.
+    static bool declareImage(Image &I, const std::string &Path) {
+        for (auto &[Name, S]: I.Structs)
+            StructDecls[Name] = std::move(S);
+        for (auto &[Name, P]: I.Protos)
+            FunctionProtos[Name] = std::move(P);
+        for (auto &[Name, G]: I.Globals)
+            GlobalVars[Name] = std::move(G);
+
+        // Generic fns and generators are compiled per call site, parse them
+        // again. Nothing else is.
+        auto SavedTokens = std::move(lexer::tokens);
+        size_t SavedIndex = lexer::tokIndex;
+        lexer::tokens = std::move(I.Tokens);
+        lexer::tokIndex = 0;
+        SetParseMode(File);
+        bool Ok = true;
+        while (Ok && GetToken().tok != lexer::EOF_TK) {
+            if (GetToken().tok == lexer::FN_TK) {
+                CompileFuncDef();
+            } else if (GetToken().tok == lexer::GEN_TK) {
+                InterpretGenDef();
+            } else {
+                Ok = false;
+            }
+        }
+        lexer::tokens = std::move(SavedTokens);
+        lexer::tokIndex = SavedIndex;
+        if (!Ok) {
+            minilog::log_error("malformed snapshot {}", Path);
+            return false;
+        }
+        return true;
+    }
+
+    // The unit defining each fn of the units imported so far.
+    static thread_local std::map<std::string, std::string> UnitFns;
+
+    // Whether no unit imported before defines a fn of I. Units are linked in
+    // the order they came, one of the bodies would be shadowed silently.
+    static bool claimFns(const Image &I, const std::string &Path) {
+        std::string Unit = I.Source.empty() ? Path : I.Source;
+        bool Ok = true;
+        for (const auto &Name: I.Defined) {
+            auto [It, New] = UnitFns.emplace(Name, Unit);
+            if (!New) {
+                minilog::log_error("{} is defined by both {} and {}", Name, It->second, Unit);
+                Ok = false;
+            }
+        }
+        return Ok;
+    }
+
+    bool DeclareUnit(const std::string &Path) {
+        Image I;
+        if (!openImage(Path, I))
+            return false;
+        if (std::ranges::find(Imported, Path) == Imported.end()) {
+            if (!claimFns(I, Path))
+                return false;
+            Imported.push_back(Path);
+        }
+        return declareImage(I, Path);
+    }
+
+    void ClearImports() {
+        Imported.clear();
+        UnitFns.clear();
+    }
+
+    bool LoadUnit(const std::string &Path) {
+        if (TheJIT->getUnit(Path))
+            return true;
+        Image I;
+        if (!openImage(Path, I))
+            return false;
+        for (const auto &Dep: I.Imports) {
+            if (!LoadUnit(Dep))
+                return false;
+        }
+        if (!claimFns(I, Path) || !declareImage(I, Path))
+            return false;
+        auto JD = TheJIT->addUnit(Path);
+        if (!JD)
+            return !JITFailed(JD.takeError(), Path);
+        if (JITFailed(TheJIT->addUnitObject(*JD, llvm::MemoryBuffer::getMemBuffer(I.Obj, Path, false),
+                                            std::move(I.File), I.Defined), Path))
+            return false;
+        auto Init = TheJIT->lookup(*JD, SnapshotInit);
+        if (!Init)
+            return !JITFailed(Init.takeError(), Path);
+        return RunJITCode(Init->getAddress());
+    }
+
+    bool LoadSnapshot(const std::string &Path) {
+        Image I;
+        if (!openImage(Path, I))
+            return false;
+        for (const auto &Dep: I.Imports) {
+            if (!LoadUnit(Dep))
+                return false;
+        }
+        if (!declareImage(I, Path))
+            return false;
+
+        if (JITFailed(TheJIT->addObjectFile(llvm::MemoryBuffer::getMemBuffer(I.Obj, Path, false), std::move(I.File)),
+                      Path))
+            return false;
+        // Behind stubs like any fn defined in the session, so it can redefine them.
+        for (const auto &Name: I.Defined) {
+            if (JITFailed(TheJIT->defineFunction(Name, Name + "$1"), Name))
+                return false;
+            Definitions[Name] = Versions[Name] = 1;
+        }
+
+        auto Init = TheJIT->lookup(SnapshotInit);
+        if (!Init)
+            return !JITFailed(Init.takeError(), Path);
+        return RunJITCode(Init->getAddress());
+    }
+}
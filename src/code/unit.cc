@@ -0,0 +1,220 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "code/unit.h"
+#include "code/gen.h"
+#include "code/snapshot.h"
+#include "engine/engine.h"
+#include "parser/parser.h"
+#include "utils/options.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/TargetParser/Host.h"
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+namespace dust::code{
+    namespace fs = std::filesystem;
+
+    namespace {
+        struct Unit {
+            // empty if it failed to compile
+            std::string Image;
+            // hash of the source, of what it is compiled with and of the
+            // imported units, names the image
+            std::string Key;
+        };
+    }
+
+    // The importer's options that change the code of a unit, tiering leaves
+    // fns unoptimized and a profile steers the optimizer.
+    static std::string codeOptions(const Options &O) {
+        return std::format("tiered={} profile={}", O.Tiered, O.ProfileUse);
+    }
+
+    // Shared by the engines of all threads, each unit (as of its last change)
+    // is compiled once per set of code options.
+    static std::mutex UnitsMutex;
+    static std::map<std::tuple<std::string, fs::file_time_type, std::string>, std::shared_future<Unit>> Units;
+
+    static std::string resolve(const std::string &From, const std::string &File) {
+        fs::path Path = fs::path(From).parent_path() / File;
+        std::error_code EC;
+        fs::path Canonical = fs::weakly_canonical(Path, EC);
+        return (EC ? Path : Canonical).string();
+    }
+
+    static bool readSource(const std::string &Path, std::string &Source) {
+        std::ifstream In(Path, std::ios::binary);
+        if (!In) {
+            minilog::log_error("can not read unit {}", Path);
+            return false;
+        }
+        std::ostringstream Buf;
+        Buf << In.rdbuf();
+        Source = Buf.str();
+        return true;
+    }
+
+    // The units imported from Tokens[From...], the source file File.
+    static std::vector<std::string> importsOf(const std::vector<lexer::Token> &Tokens, size_t From,
+                                              const std::string &File) {
+        std::vector<std::string> Paths;
+        for (size_t i = From; i + 1 < Tokens.size(); ++i) {
+            if (Tokens[i].tok == lexer::IMPORT_TK && Tokens[i + 1].tok == lexer::STRLIT_TK)
+                Paths.push_back(resolve(File, Tokens[i + 1].val));
+        }
+        return Paths;
+    }
+
+    // Whether Path leads back to a file on Chain through its imports. Each
+    // waits for the units it imports, a cycle would wait forever.
+    static bool importsCycle(const std::string &Path, std::vector<std::string> &Chain, std::set<std::string> &Acyclic) {
+        if (std::ranges::find(Chain, Path) != Chain.end()) {
+            minilog::log_error("{} imports itself through {}", Path, Chain.back());
+            return true;
+        }
+        std::string Source;
+        if (Acyclic.contains(Path) || !readSource(Path, Source))
+            return false;
+        Chain.push_back(Path);
+        for (const auto &Dep: importsOf(lexer::lexLine(Source), 0, Path)) {
+            if (importsCycle(Dep, Chain, Acyclic))
+                return true;
+        }
+        Chain.pop_back();
+        Acyclic.insert(Path);
+        return false;
+    }
+
+    static std::shared_future<Unit> request(const std::string &Path, const Options &O);
+
+    // Compile the unit at Path with the options O of its importer, on this thread.
+    static Unit build(const std::string &Path, Options O) {
+        std::string Source;
+        if (!readSource(Path, Source))
+            return {};
+        auto Tokens = lexer::lexLine(Source);
+        O.Source = Path;
+        std::vector<std::shared_future<Unit>> Deps;
+        for (const auto &Dep: importsOf(Tokens, 0, Path))
+            Deps.push_back(request(Dep, O));
+
+        // Images are only valid for their format, the target, the dust that
+        // compiled them, the options they were compiled with and the
+        // interfaces of the units they were compiled against.
+        llvm::SHA1 Hash;
+        Hash.update(std::format("{} {} {} {} {}\n", ImageVersion, llvm::sys::getProcessTriple(),
+                                llvm::sys::getHostCPUName().str(), CompilerId(), codeOptions(O)));
+        if (!O.ProfileUse.empty()) {
+            auto Profile = llvm::MemoryBuffer::getFile(O.ProfileUse);
+            if (!Profile) {
+                minilog::log_error("can not read profile {}: {}", O.ProfileUse, Profile.getError().message());
+                return {};
+            }
+            Hash.update((*Profile)->getBuffer());
+        }
+        Hash.update(Source);
+        for (auto &Dep: Deps) {
+            const Unit &U = Dep.get();
+            if (U.Image.empty())
+                return {};
+            Hash.update(U.Key);
+        }
+        std::string Key = llvm::toHex(Hash.final(), /*LowerCase*/ true);
+        fs::path Dir = O.CacheDir.empty() ? fs::temp_directory_path() / "dust-units" : fs::path(O.CacheDir) / "units";
+        std::string Image = (Dir / (Key + ".img")).string();
+        if (fs::exists(Image))
+            return {Image, Key};
+        std::error_code EC;
+        fs::create_directories(Dir, EC);
+        if (EC) {
+            minilog::log_error("can not create {}: {}", Dir.string(), EC.message());
+            return {};
+        }
+
+        // A --snapshot of the unit, by an engine of this thread.
+        O.Scripts.clear();
+        O.Workers = 0;
+        O.ServeSocket.clear();
+        O.ClientSocket.clear();
+        O.LoadImage.clear();
+        O.ProfileGenerate.clear();
+        O.Echo = false;
+        O.Output = Options::OutputKind::Snapshot;
+        // Another process, or another path to the same source, may be writing it too.
+        O.OutputPath = std::format("{}.{}.{}", Image, llvm::sys::Process::getProcessId(),
+                                   std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        auto TheEngine = Engine::Create(O);
+        if (!TheEngine)
+            return {};
+        lexer::tokens = std::move(Tokens);
+        lexer::tokIndex = 0;
+        parser::SetParseMode(parser::File);
+        if (CompileProgram() != 0) {
+            fs::remove(O.OutputPath, EC);
+            minilog::log_error("unit {} does not compile", Path);
+            return {};
+        }
+        fs::rename(O.OutputPath, Image, EC);
+        if (EC) {
+            minilog::log_error("can not write {}: {}", Image, EC.message());
+            return {};
+        }
+        return {Image, Key};
+    }
+
+    static std::shared_future<Unit> request(const std::string &Path, const Options &O) {
+        std::error_code EC;
+        auto Id = std::make_tuple(Path, fs::last_write_time(Path, EC), codeOptions(O));
+        std::lock_guard<std::mutex> Guard(UnitsMutex);
+        auto &Result = Units[Id];
+        if (Result.valid())
+            return Result;
+        std::vector<std::string> Chain;
+        std::set<std::string> Acyclic;
+        if (!O.Source.empty())
+            Chain.push_back(resolve("", O.Source));
+        if (importsCycle(Path, Chain, Acyclic)) {
+            std::promise<Unit> Failed;
+            Failed.set_value({});
+            Result = Failed.get_future().share();
+        } else {
+            Result = std::async(std::launch::async, build, Path, O).share();
+        }
+        return Result;
+    }
+
+    std::string ResolveImport(const std::string &File) {
+        return resolve(Opts.Source, File);
+    }
+
+    void PrefetchImports() {
+        if (Opts.Output != Options::OutputKind::JIT && Opts.Output != Options::OutputKind::Snapshot)
+            return;
+        for (const auto &Path: importsOf(lexer::tokens, lexer::tokIndex, Opts.Source))
+            request(Path, Opts);
+    }
+
+    std::string UnitImage(const std::string &Path) {
+        return request(Path, Opts).get().Image;
+    }
+
+    std::vector<std::string> ImportedImages(const std::string &Source, const std::string &File) {
+        std::vector<std::string> Images;
+        for (const auto &Path: importsOf(lexer::lexLine(Source), 0, File))
+            Images.push_back(request(Path, Opts).get().Image);
+        return Images;
+    }
+}
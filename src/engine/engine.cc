@@ -0,0 +1,147 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "engine/engine.h"
+#include "parser/parser.h"
+#include "code/snapshot.h"
+#include "jit/worker.h"
+#include <algorithm>
+#include <mutex>
+
+namespace dust{
+    std::unique_ptr<Engine> Engine::Create(const Options &O) {
+        if (parser::TheJIT) {
+            minilog::log_error("there can only be one dust engine per thread");
+            return nullptr;
+        }
+        Opts = O;
+        static std::once_flag Initialized;
+        std::call_once(Initialized, [] {
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+            llvm::InitializeNativeTargetAsmParser();
+        });
+        std::unique_ptr<ExecutorProcessControl> Worker;
+        if (Opts.Workers) {
+            auto W = LaunchWorker();
+            if (!W) {
+                minilog::log_error("can not launch a worker: {}", llvm::toString(W.takeError()));
+                return nullptr;
+            }
+            Worker = std::move(*W);
+        }
+        // The server forks per request, a thread of the JIT's pool would be
+        // missing from the child along with the locks it holds.
+        parser::TheJIT = DustJIT::Create(Opts.Lazy, Opts.CacheDir, Opts.CacheSize, Opts.JITLink, Opts.HugePages,
+                                         std::move(Worker), !Opts.ServeSocket.empty());
+        if (!parser::TheJIT) {
+            minilog::log_error("can not create the JIT");
+            return nullptr;
+        }
+        // Any failure below leaves the thread free for another try.
+        auto E = std::unique_ptr<Engine>(new Engine());
+        if (Opts.Lazy || !Opts.CacheDir.empty()) {
+            // Runs on the JIT's threads, which have no TheJIT of their own.
+            parser::TheJIT->setOptimizer([JIT = parser::TheJIT.get()](auto TSM, const auto &R) {
+                return parser::OptimizeJITModule(*JIT, std::move(TSM), R);
+            });
+        }
+        if (!Opts.ProfileUse.empty() && !parser::LoadProfile(Opts.ProfileUse)) {
+            return nullptr;
+        }
+        parser::InitModuleAndManagers();
+        if (!Opts.LoadImage.empty() && !code::LoadSnapshot(Opts.LoadImage)) {
+            return nullptr;
+        }
+        return E;
+    }
+    
+    std::unique_ptr<Engine> Engine::Create() {
+        Options O;
+        O.Echo = false;
+        O.Batch = true;
+        return Create(O);
+    }
+    
+    Engine::~Engine() {
+        parser::ClearState();
+    }
+    
+    bool Engine::compile(const std::string &Source) {
+        unsigned Errors = minilog::error_count();
+        lexer::tokens = lexer::lexLine(Source);
+        lexer::tokIndex = 0;
+        parser::SetParseMode(parser::File);
+        parser::MainLoop();
+        return minilog::error_count() == Errors;
+    }
+    
+    bool Engine::define(const std::string &Name, void *Fn) {
+        if (parser::TheJIT->isRemote()) {
+            minilog::log_error("can not define {}, scripts run in a worker", Name);
+            return false;
+        }
+        if (auto Err = parser::TheJIT->addHostFunction(Name, llvm::orc::ExecutorAddr::fromPtr(Fn))) {
+            minilog::log_error("can not define {}: {}", Name, llvm::toString(std::move(Err)));
+            return false;
+        }
+        return true;
+    }
+    
+    BatchFn Engine::batch(const std::string &Name) {
+        if (parser::TheJIT->isRemote()) {
+            minilog::log_error("{} runs in a worker, it can not be called from here", Name);
+            return nullptr;
+        }
+        auto Def = parser::Definitions.find(Name);
+        if (Def == parser::Definitions.end()) {
+            minilog::log_error("no fn {} is defined", Name);
+            return nullptr;
+        }
+        auto It = Batches.find(Name);
+        if (It != Batches.end() && It->second.first == Def->second)
+            return It->second.second;
+        std::string Batch = parser::BatchFunction(Name);
+        if (Batch.empty())
+            return nullptr;
+        auto Sym = parser::TheJIT->lookup(Batch);
+        if (!Sym) {
+            minilog::log_error("can not find {}: {}", Batch, llvm::toString(Sym.takeError()));
+            return nullptr;
+        }
+        auto *Fn = Sym->getAddress().toPtr<BatchFn>();
+        Batches[Name] = {Def->second, Fn};
+        return Fn;
+    }
+    
+    void *Engine::address(const std::string &Name, lexer::TokenId Ret, std::span<const lexer::TokenId> Args) {
+        if (parser::TheJIT->isRemote()) {
+            minilog::log_error("{} runs in a worker, it can not be called from here", Name);
+            return nullptr;
+        }
+        auto It = Symbols.find(Name);
+        if (It == Symbols.end()) {
+            // Externs have a prototype too, only defined fns are counted.
+            auto PI = parser::FunctionProtos.find(Name);
+            if (PI == parser::FunctionProtos.end() || !parser::Definitions.contains(Name)) {
+                minilog::log_error("no fn {} is defined", Name);
+                return nullptr;
+            }
+            auto Sym = parser::TheJIT->lookup(Name);
+            if (!Sym) {
+                minilog::log_error("can not find {}: {}", Name, llvm::toString(Sym.takeError()));
+                return nullptr;
+            }
+            std::vector<lexer::TokenId> ArgIds;
+            for (const auto &A: PI->second->getArgs())
+                ArgIds.push_back(A.typeId);
+            It = Symbols.emplace(Name, Symbol{Sym->getAddress().toPtr<void *>(), PI->second->getRetType(),
+                                              std::move(ArgIds)}).first;
+        }
+        if (It->second.Ret != Ret || !std::ranges::equal(It->second.Args, Args)) {
+            minilog::log_error("{} does not have the requested signature", Name);
+            return nullptr;
+        }
+        return It->second.Addr;
+    }
+}
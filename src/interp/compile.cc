@@ -0,0 +1,441 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "interp/bytecode.h"
+#include "parser/parser.h"
+#include <algorithm>
+#include <optional>
+#include <set>
+
+namespace dust::interp{
+    using namespace ast;
+    using namespace parser;
+
+    static std::optional<Kind> kindOf(lexer::TokenId T) {
+        if (T == lexer::NUM_TK)
+            return Kind::Num;
+        if (T == lexer::STR_TK)
+            return Kind::Str;
+        return std::nullopt;
+    }
+
+    // String literals live for the whole run, like the JIT's: they may be
+    // stored in globals and outlive the bytecode.
+    static const char *internString(const std::string &S) {
+        static thread_local std::set<std::string> Strings;
+        return Strings.insert(S).first->c_str();
+    }
+
+    // Registers are allocated like a stack: the args, then the locals of the
+    // open scopes, then the temporaries of the statement being translated.
+    class Compiler {
+        struct Local {
+            std::string Name;
+            uint32_t Reg;
+            Kind K;
+        };
+
+        Function &F;
+        Kind RetKind = Kind::Num;
+        // innermost last
+        std::vector<Local> Locals;
+        uint32_t NextReg = 0;
+
+        uint32_t alloc() {
+            F.NumRegs = std::max(F.NumRegs, NextReg + 1);
+            return NextReg++;
+        }
+
+        uint32_t emit(Opcode Op, uint32_t A = 0, uint32_t B = 0, uint32_t C = 0) {
+            F.Code.push_back({Op, A, B, C});
+            return static_cast<uint32_t>(F.Code.size() - 1);
+        }
+
+        uint32_t here() const { return static_cast<uint32_t>(F.Code.size()); }
+
+        // Point the jump At to the next instruction.
+        void patch(uint32_t At) { F.Code[At].B = here(); }
+
+        uint32_t constant(Slot S) {
+            F.Consts.push_back(S);
+            return static_cast<uint32_t>(F.Consts.size() - 1);
+        }
+
+        uint32_t zero(Kind K) {
+            Slot S{};
+            if (K == Kind::Num)
+                S.Num = 0;
+            else
+                S.Str = nullptr;
+            return constant(S);
+        }
+
+        const Local *lookup(const std::string &Name) const {
+            for (auto It = Locals.rbegin(); It != Locals.rend(); ++It) {
+                if (It->Name == Name)
+                    return &*It;
+            }
+            return nullptr;
+        }
+
+        // The global's address in the JIT and its kind.
+        std::optional<std::pair<uint32_t, Kind>> global(const std::string &Name, bool Store) {
+            auto GI = GlobalVars.find(Name);
+            if (GI == GlobalVars.end() || (Store && GI->second->isConst()))
+                return std::nullopt;
+            auto K = kindOf(GI->second->getVar().typeId);
+            if (!K)
+                return std::nullopt;
+            auto Sym = TheJIT->lookupGlobal(Name);
+            if (!Sym) {
+                llvm::consumeError(Sym.takeError());
+                return std::nullopt;
+            }
+            F.Globals.push_back(Sym->getAddress().toPtr<Slot *>());
+            return std::make_pair(static_cast<uint32_t>(F.Globals.size() - 1), *K);
+        }
+
+        // E in a register: a local's own, or a new temporary. Copied if Copy,
+        // when what is evaluated next may assign to the local.
+        std::optional<std::pair<uint32_t, Kind>> operand(ExprAST &E, bool Copy = false) {
+            if (auto *V = dynamic_cast<VariableExprAST *>(&E)) {
+                if (auto *L = lookup(V->getName())) {
+                    if (!Copy)
+                        return std::make_pair(L->Reg, L->K);
+                    uint32_t Reg = alloc();
+                    emit(Opcode::Move, Reg, L->Reg);
+                    return std::make_pair(Reg, L->K);
+                }
+            }
+            uint32_t Reg = alloc();
+            auto K = expr(E, Reg);
+            if (!K)
+                return std::nullopt;
+            return std::make_pair(Reg, *K);
+        }
+
+        std::optional<uint32_t> numOperand(ExprAST &E, bool Copy = false) {
+            auto Op = operand(E, Copy);
+            if (!Op || Op->second != Kind::Num)
+                return std::nullopt;
+            return Op->first;
+        }
+
+        std::optional<Kind> binary(BinaryExprAST &B, uint32_t Dst) {
+            lexer::TokenId Op = B.getOp();
+            if (Op == lexer::ASSIGN_TK) {
+                auto *Var = dynamic_cast<VariableExprAST *>(B.getLHS());
+                if (!Var)
+                    return std::nullopt;
+                if (auto *L = lookup(Var->getName())) {
+                    // Not evaluated in place, && and if-exprs write Dst before
+                    // they are done reading the variable.
+                    uint32_t Reg = L->Reg;
+                    Kind K = L->K;
+                    if (expr(*B.getRHS(), Dst) != K)
+                        return std::nullopt;
+                    emit(Opcode::Move, Reg, Dst);
+                    return K;
+                }
+                auto G = global(Var->getName(), true);
+                if (!G || expr(*B.getRHS(), Dst) != G->second)
+                    return std::nullopt;
+                emit(Opcode::StoreGlobal, Dst, G->first);
+                return G->second;
+            }
+            if (Op == lexer::AND_TK || Op == lexer::OR_TK) {
+                // Short-circuit, the right operand decides if the left one does not.
+                if (expr(*B.getLHS(), Dst) != Kind::Num)
+                    return std::nullopt;
+                emit(Opcode::Truth, Dst, Dst);
+                uint32_t Skip = emit(Op == lexer::AND_TK ? Opcode::JumpIfFalse : Opcode::JumpIfTrue, Dst);
+                if (expr(*B.getRHS(), Dst) != Kind::Num)
+                    return std::nullopt;
+                emit(Opcode::Truth, Dst, Dst);
+                patch(Skip);
+                return Kind::Num;
+            }
+
+            Opcode Code;
+            switch (Op) {
+                case lexer::ADD_TK: Code = Opcode::Add; break;
+                case lexer::SUB_TK: Code = Opcode::Sub; break;
+                case lexer::MUL_TK: Code = Opcode::Mul; break;
+                case lexer::DIV_TK: Code = Opcode::Div; break;
+                case lexer::LESS_TK: Code = Opcode::Lt; break;
+                case lexer::LESSEQ_TK: Code = Opcode::Le; break;
+                case lexer::GREATER_TK: Code = Opcode::Gt; break;
+                case lexer::GREATEEQ_TK: Code = Opcode::Ge; break;
+                case lexer::EQ_TK: Code = Opcode::Eq; break;
+                case lexer::NOTEQ_TK: Code = Opcode::Ne; break;
+                default:
+                    return std::nullopt;
+            }
+            // Only a variable or a literal on the right can not assign to
+            // the local on the left, as in x + (x = 5).
+            ExprAST *RHS = B.getRHS();
+            bool Pure = dynamic_cast<VariableExprAST *>(RHS) || dynamic_cast<NumberExprAST *>(RHS);
+            auto L = numOperand(*B.getLHS(), !Pure);
+            auto R = L ? numOperand(*B.getRHS()) : std::nullopt;
+            if (!R)
+                return std::nullopt;
+            emit(Code, Dst, *L, *R);
+            return Kind::Num;
+        }
+
+        std::optional<Kind> call(CallExprAST &C, uint32_t Dst) {
+            const std::string &Name = C.getCallee();
+            // Struct constructors and instances of generic fns only exist as IR.
+            if (StructDecls.contains(Name) || GenericFuncs.contains(Name))
+                return std::nullopt;
+            auto PI = FunctionProtos.find(Name);
+            if (PI == FunctionProtos.end() || PI->second->getArgs().size() != C.getArgs().size())
+                return std::nullopt;
+            auto &Proto = *PI->second;
+            std::vector<Kind> ArgKinds;
+            for (const auto &A: Proto.getArgs()) {
+                auto K = kindOf(A.typeId);
+                if (!K)
+                    return std::nullopt;
+                ArgKinds.push_back(*K);
+            }
+            auto RetKind = kindOf(Proto.getRetType());
+            NativeThunk Thunk = RetKind ? GetThunk(ArgKinds, *RetKind) : nullptr;
+            if (!Thunk)
+                return std::nullopt;
+
+            // The args go to consecutive registers, each evaluated above them.
+            uint32_t Base = NextReg;
+            for (size_t i = 0; i < ArgKinds.size(); ++i)
+                alloc();
+            for (size_t i = 0; i < ArgKinds.size(); ++i) {
+                if (expr(*C.getArgs()[i], Base + i) != ArgKinds[i])
+                    return std::nullopt;
+                NextReg = Base + ArgKinds.size();
+            }
+            F.Calls.push_back({&GetEntry(Name), Thunk});
+            emit(Opcode::Call, Dst, static_cast<uint32_t>(F.Calls.size() - 1), Base);
+            return RetKind;
+        }
+
+        // Evaluate E into Dst, its kind or nullopt if E can not be interpreted.
+        std::optional<Kind> expr(ExprAST &E, uint32_t Dst) {
+            if (auto *N = dynamic_cast<NumberExprAST *>(&E)) {
+                Slot S{};
+                S.Num = N->getVal();
+                emit(Opcode::LoadK, Dst, constant(S));
+                return Kind::Num;
+            }
+            if (auto *Str = dynamic_cast<StringExprAST *>(&E)) {
+                Slot S{};
+                S.Str = internString(Str->getStr());
+                emit(Opcode::LoadK, Dst, constant(S));
+                return Kind::Str;
+            }
+            if (auto *V = dynamic_cast<VariableExprAST *>(&E)) {
+                if (auto *L = lookup(V->getName())) {
+                    if (L->Reg != Dst)
+                        emit(Opcode::Move, Dst, L->Reg);
+                    return L->K;
+                }
+                auto G = global(V->getName(), false);
+                if (!G)
+                    return std::nullopt;
+                emit(Opcode::LoadGlobal, Dst, G->first);
+                return G->second;
+            }
+            if (auto *B = dynamic_cast<BinaryExprAST *>(&E))
+                return binary(*B, Dst);
+            if (auto *N = dynamic_cast<NotExprAST *>(&E)) {
+                auto Reg = numOperand(*N->getOperand());
+                if (!Reg)
+                    return std::nullopt;
+                emit(Opcode::Not, Dst, *Reg);
+                return Kind::Num;
+            }
+            if (auto *C = dynamic_cast<CallExprAST *>(&E))
+                return call(*C, Dst);
+            if (auto *I = dynamic_cast<IfExprAST *>(&E)) {
+                auto Cond = numOperand(*I->getCond());
+                if (!Cond)
+                    return std::nullopt;
+                uint32_t ToElse = emit(Opcode::JumpIfFalse, *Cond);
+                if (expr(*I->getThen(), Dst) != Kind::Num)
+                    return std::nullopt;
+                uint32_t ToEnd = emit(Opcode::Jump);
+                patch(ToElse);
+                if (expr(*I->getElse(), Dst) != Kind::Num)
+                    return std::nullopt;
+                patch(ToEnd);
+                return Kind::Num;
+            }
+            // Field accesses.
+            return std::nullopt;
+        }
+
+        // Like codegen, nothing after a return is translated.
+        bool block(const std::vector<std::unique_ptr<StmtAST>> &Body) {
+            for (const auto &S: Body) {
+                if (!stmt(*S))
+                    return false;
+                if (dynamic_cast<ReturnStmtAST *>(S.get()))
+                    break;
+            }
+            return true;
+        }
+
+        bool stmt(StmtAST &S) {
+            // Temporaries and the locals declared here are freed at the end.
+            uint32_t Mark = NextReg;
+            bool Ok = stmtAt(S);
+            NextReg = Mark;
+            return Ok;
+        }
+
+        bool stmtAt(StmtAST &S) {
+            if (auto *R = dynamic_cast<RegularStmtAST *>(&S))
+                return operand(*R->val).has_value();
+            if (auto *R = dynamic_cast<ReturnStmtAST *>(&S)) {
+                auto Op = R->retVal ? operand(*R->retVal) : std::nullopt;
+                if (!Op || Op->second != RetKind)
+                    return false;
+                emit(Opcode::Ret, Op->first);
+                return true;
+            }
+            if (auto *I = dynamic_cast<IfStmtAST *>(&S)) {
+                auto Cond = numOperand(*I->Cond);
+                if (!Cond)
+                    return false;
+                uint32_t ToElse = emit(Opcode::JumpIfFalse, *Cond);
+                if (!block(I->Then))
+                    return false;
+                uint32_t ToEnd = emit(Opcode::Jump);
+                patch(ToElse);
+                if (!block(I->Else))
+                    return false;
+                patch(ToEnd);
+                return true;
+            }
+            if (auto *For = dynamic_cast<ForStmtAST *>(&S)) {
+                // As in codegen: the start value without the variable in scope,
+                // the step once with it, then the condition on every iteration.
+                uint32_t Var = alloc();
+                if (expr(*For->Init, Var) != Kind::Num)
+                    return false;
+                Locals.push_back({For->VarName, Var, Kind::Num});
+                uint32_t Step = alloc();
+                if (For->Then) {
+                    if (expr(*For->Then, Step) != Kind::Num)
+                        return false;
+                } else {
+                    Slot One{};
+                    One.Num = 1;
+                    emit(Opcode::LoadK, Step, constant(One));
+                }
+                uint32_t Top = here();
+                auto Cond = numOperand(*For->Cond);
+                if (!Cond)
+                    return false;
+                uint32_t ToEnd = emit(Opcode::JumpIfFalse, *Cond);
+                NextReg = Step + 1;
+                if (!block(For->Body))
+                    return false;
+                emit(Opcode::Add, Var, Var, Step);
+                emit(Opcode::Loop, 0, Top);
+                patch(ToEnd);
+                Locals.pop_back();
+                F.HasLoops = true;
+                return true;
+            }
+            if (auto *V = dynamic_cast<VarStmtAST *>(&S)) {
+                size_t Scope = Locals.size();
+                for (const auto &[Var, Init]: V->vars) {
+                    auto K = kindOf(Var.typeId);
+                    if (!K)
+                        return false;
+                    // The initializer does not see the variable yet.
+                    uint32_t Reg = alloc();
+                    if (Init) {
+                        if (expr(*Init, Reg) != K)
+                            return false;
+                    } else {
+                        emit(Opcode::LoadK, Reg, zero(*K));
+                    }
+                    NextReg = Reg + 1;
+                    Locals.push_back({Var.name, Reg, *K});
+                }
+                bool Ok = block(V->Body);
+                Locals.resize(Scope);
+                return Ok;
+            }
+            if (auto *M = dynamic_cast<MatchStmtAST *>(&S)) {
+                auto Val = numOperand(*M->Val);
+                if (!Val)
+                    return false;
+                // A compare per label, only an integral value can equal one.
+                std::set<int64_t> Seen;
+                std::vector<std::vector<uint32_t>> ToCase(M->Cases.size());
+                for (size_t i = 0; i < M->Cases.size(); ++i) {
+                    for (int64_t Label: M->Cases[i].Labels) {
+                        // Left to the JIT, which reports it.
+                        if (!Seen.insert(Label).second)
+                            return false;
+                        Slot K{};
+                        K.Num = static_cast<double>(Label);
+                        ToCase[i].push_back(emit(Opcode::JumpIfEqK, *Val, 0, constant(K)));
+                    }
+                }
+                uint32_t ToDefault = emit(Opcode::Jump);
+                std::vector<uint32_t> ToEnd;
+                for (size_t i = 0; i < M->Cases.size(); ++i) {
+                    for (uint32_t J: ToCase[i])
+                        patch(J);
+                    if (!block(M->Cases[i].Body))
+                        return false;
+                    ToEnd.push_back(emit(Opcode::Jump));
+                }
+                patch(ToDefault);
+                if (!block(M->Default))
+                    return false;
+                for (uint32_t J: ToEnd)
+                    patch(J);
+                return true;
+            }
+            if (dynamic_cast<EmptyStmt *>(&S))
+                return true;
+            // yield and for-in over a generator.
+            return false;
+        }
+
+    public:
+        explicit Compiler(Function &F) : F(F) {}
+
+        bool compile(FunctionAST &Fn) {
+            auto &Proto = Fn.getProto();
+            auto K = kindOf(Proto.getRetType());
+            if (!K)
+                return false;
+            RetKind = *K;
+            for (const auto &A: Proto.getArgs()) {
+                auto ArgK = kindOf(A.typeId);
+                if (!ArgK)
+                    return false;
+                Locals.push_back({A.name, alloc(), *ArgK});
+            }
+            F.NumArgs = static_cast<uint32_t>(Locals.size());
+            // A body that can fall off its end does not verify, the JIT reports it.
+            auto &Body = Fn.getBody();
+            if (std::ranges::none_of(Body, [](const auto &S) { return dynamic_cast<ReturnStmtAST *>(S.get()); }))
+                return false;
+            return block(Body);
+        }
+    };
+
+    std::unique_ptr<Function> Compile(FunctionAST &Fn) {
+        auto F = std::make_unique<Function>();
+        F->Name = Fn.getProto().getName();
+        if (!Compiler(*F).compile(Fn))
+            return nullptr;
+        return F;
+    }
+}
@@ -0,0 +1,140 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "interp/interp.h"
+#include "interp/bytecode.h"
+#include "parser/parser.h"
+#include "utils/options.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include <algorithm>
+#include <format>
+
+namespace dust::interp{
+    using namespace parser;
+
+    // Called by the trampolines, runs the bytecode of a fn for JIT'd code.
+    static constexpr llvm::StringLiteral EnterFn = "__dust_interp_enter";
+
+    static thread_local std::map<std::string, Entry> Entries;
+
+    // Bytecode replaced by a new definition or a promotion, it may still be
+    // running until the current top-level item is done.
+    static thread_local std::vector<std::unique_ptr<Function>> Retired;
+
+    // Args holds the args of F, the result is written to its first slot.
+    static void enter(Function *F, Slot *Args) {
+        Args[0] = Run(*F, Args);
+    }
+
+    Entry &GetEntry(const std::string &Name) {
+        auto [It, Inserted] = Entries.try_emplace(Name);
+        if (Inserted)
+            It->second.Name = Name;
+        return It->second;
+    }
+
+    void *NativeAddress(Entry &E) {
+        // The stub of a fn stays where it is when the fn is redefined.
+        if (!E.Addr) {
+            auto Sym = TheJIT->lookup(E.Name);
+            if (JITFailed(Sym.takeError(), E.Name))
+                return nullptr;
+            E.Addr = Sym->getAddress().toPtr<void *>();
+        }
+        return E.Addr;
+    }
+
+    // The body Impl of the fn Proto for JIT'd callers: spill the args into
+    // slots and enter the interpreter with F.
+    static llvm::orc::ThreadSafeModule emitTrampoline(Function &F, PrototypeAST &Proto, const std::string &Impl) {
+        if (!TheJIT->hasHostFunction(EnterFn))
+            ExitOnErr(TheJIT->addHostFunction(EnterFn, llvm::orc::ExecutorAddr::fromPtr(&enter)));
+
+        auto Ctx = std::make_unique<llvm::LLVMContext>();
+        auto M = std::make_unique<llvm::Module>(Impl, *Ctx);
+        M->setDataLayout(TheJIT->getDataLayout());
+        llvm::IRBuilder<> B(*Ctx);
+        auto *PtrTy = llvm::PointerType::getUnqual(*Ctx);
+        auto TypeOf = [&](lexer::TokenId T) -> llvm::Type * {
+            return T == lexer::STR_TK ? PtrTy : B.getDoubleTy();
+        };
+        std::vector<llvm::Type *> Params;
+        for (const auto &A: Proto.getArgs())
+            Params.push_back(TypeOf(A.typeId));
+        llvm::Type *RetTy = TypeOf(Proto.getRetType());
+        auto *Fn = llvm::Function::Create(llvm::FunctionType::get(RetTy, Params, false),
+                                          llvm::Function::ExternalLinkage, Impl, M.get());
+        B.SetInsertPoint(llvm::BasicBlock::Create(*Ctx, "entry", Fn));
+
+        // A Slot is 8 bytes, there is always one for the result.
+        auto *SlotsTy = llvm::ArrayType::get(B.getInt64Ty(), std::max<size_t>(Params.size(), 1));
+        auto *Slots = B.CreateAlloca(SlotsTy, nullptr, "slots");
+        for (auto &Arg: Fn->args())
+            B.CreateStore(&Arg, B.CreateConstGEP2_32(SlotsTy, Slots, 0, Arg.getArgNo()));
+        llvm::FunctionCallee Enter = M->getOrInsertFunction(
+                EnterFn, llvm::FunctionType::get(B.getVoidTy(), {PtrTy, PtrTy}, false));
+        llvm::Value *FPtr = B.CreateIntToPtr(B.getInt64(reinterpret_cast<uint64_t>(&F)), PtrTy);
+        B.CreateCall(Enter, {FPtr, Slots});
+        B.CreateRet(B.CreateLoad(RetTy, B.CreateConstGEP2_32(SlotsTy, Slots, 0, 0)));
+        return {std::move(M), std::move(Ctx)};
+    }
+
+    bool DefineFunction(std::unique_ptr<FunctionAST> &Fn) {
+        auto &Proto = Fn->getProto();
+        std::string Name = Proto.getName();
+        // Calls to the fn itself, and JIT'd callers later on, go by its prototype.
+        FunctionProtos[Name] = std::make_unique<PrototypeAST>(Proto);
+        auto F = Compile(*Fn);
+        if (!F)
+            return false;
+        Retired.clear();
+
+        if (Opts.Echo)
+            fprintf(stderr, "Read function definition: %s, interpreted\n", Name.c_str());
+        std::string Impl = std::format("{}${}", Name, ++Versions[Name]);
+        // Skipped like a fn the JIT fails on.
+        if (JITFailed(TheJIT->defineFunction(Name, Impl, emitTrampoline(*F, Proto, Impl)).takeError(), Name))
+            return true;
+        ++Definitions[Name];
+        // Safe to link ahead of the first call: the trampoline only calls the
+        // host fn EnterFn, the callees of F are reached through the VM.
+        TheJIT->prefetch(Name);
+
+        F->AST = std::move(Fn);
+        Entry &E = GetEntry(Name);
+        if (E.Fn)
+            Retired.push_back(std::move(E.Fn));
+        E.Fn = std::move(F);
+        return true;
+    }
+
+    bool RunTopLevel(FunctionAST &Fn) {
+        Retired.clear();
+        auto F = Compile(Fn);
+        // Only a call can be promoted, a loop would run to its end in here.
+        if (!F || F->HasLoops)
+            return false;
+        Run(*F, nullptr);
+        return true;
+    }
+
+    void ForgetFunction(const std::string &Name) {
+        auto It = Entries.find(Name);
+        if (It != Entries.end() && It->second.Fn)
+            Retired.push_back(std::move(It->second.Fn));
+    }
+
+    void Clear() {
+        Entries.clear();
+        Retired.clear();
+    }
+
+    void Promote(Function &F) {
+        Entry &E = GetEntry(F.Name);
+        if (E.Fn.get() != &F || !F.AST)
+            return;
+        // JITFunction retires F, a running call of it finishes in bytecode.
+        auto AST = std::move(F.AST);
+        JITFunction(*AST);
+    }
+}
@@ -0,0 +1,194 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "interp/bytecode.h"
+#include "parser/parser.h"
+#include "utils/options.h"
+#include <algorithm>
+#include <array>
+#include <type_traits>
+#include <utility>
+
+namespace dust::interp{
+    // Registers of all frames running on a thread, a frame is pushed per call.
+    static constexpr size_t StackSize = 1 << 20;
+
+    // Set by a call that can not be made. The bytecode frames of the item
+    // return one after the other, JIT'd code between them carries on with
+    // what they return. Cleared once the outermost frame is gone.
+    static thread_local bool Aborted = false;
+
+    // A num as a condition, true unless it is 0 or NaN like codegenCond.
+    static bool truth(double V) { return V < 0 || V > 0; }
+
+    static void countHit(Function &F) {
+        if (++F.Hits == Opts.TierThreshold && F.AST)
+            Promote(F);
+    }
+
+    Slot Run(Function &F, const Slot *Args) {
+        static thread_local std::unique_ptr<Slot[]> Stack(new Slot[StackSize]);
+        static thread_local size_t Top = 0;
+        if (Aborted)
+            return Slot{};
+        if (StackSize - Top < F.NumRegs) {
+            minilog::log_fatal("interpreter stack overflow in {}", F.Name);
+            std::exit(10);
+        }
+        Slot *Regs = &Stack[Top];
+        std::copy_n(Args, F.NumArgs, Regs);
+        Top += F.NumRegs;
+        struct Frame {
+            size_t &Top;
+            size_t Size;
+
+            ~Frame() {
+                if (!(Top -= Size))
+                    Aborted = false;
+            }
+        } Pop{Top, F.NumRegs};
+        countHit(F);
+
+        const Insn *Code = F.Code.data();
+        const Insn *PC = Code;
+        const Slot *K = F.Consts.data();
+
+        // Threaded dispatch jumps from each handler straight to the next one.
+        // MSVC has no computed goto, it goes through the switch.
+#ifdef __GNUC__
+        static const void *Handlers[] = {
+#define DUST_OPCODE(name) &&op_##name,
+                DUST_OPCODES(DUST_OPCODE)
+#undef DUST_OPCODE
+        };
+#define DISPATCH() goto *Handlers[static_cast<size_t>(PC->Op)]
+#define CASE(name) op_##name:
+#else
+#define DISPATCH() goto dispatch
+#define CASE(name) case Opcode::name:
+#endif
+#define NEXT() ++PC; DISPATCH()
+#define ARITH(name, op) CASE(name) Regs[PC->A].Num = Regs[PC->B].Num op Regs[PC->C].Num; NEXT();
+#define CMP(name, expr) CASE(name) { double L = Regs[PC->B].Num, R = Regs[PC->C].Num; \
+        Regs[PC->A].Num = (expr) ? 1.0 : 0.0; } NEXT();
+
+#ifdef __GNUC__
+        DISPATCH();
+#else
+        dispatch:
+        switch (PC->Op) {
+#endif
+        CASE(LoadK) Regs[PC->A] = K[PC->B]; NEXT();
+        CASE(Move) Regs[PC->A] = Regs[PC->B]; NEXT();
+        CASE(LoadGlobal) Regs[PC->A] = *F.Globals[PC->B]; NEXT();
+        CASE(StoreGlobal) *F.Globals[PC->B] = Regs[PC->A]; NEXT();
+        ARITH(Add, +)
+        ARITH(Sub, -)
+        ARITH(Mul, *)
+        ARITH(Div, /)
+        // Unordered like the FCmpU* of the JIT, true when either side is NaN.
+        CMP(Lt, !(L >= R))
+        CMP(Le, !(L > R))
+        CMP(Gt, !(L <= R))
+        CMP(Ge, !(L < R))
+        CMP(Eq, !(L < R || L > R))
+        CMP(Ne, L != R)
+        CASE(Truth) Regs[PC->A].Num = truth(Regs[PC->B].Num) ? 1.0 : 0.0; NEXT();
+        CASE(Not) Regs[PC->A].Num = truth(Regs[PC->B].Num) ? 0.0 : 1.0; NEXT();
+        CASE(Jump) PC = Code + PC->B; DISPATCH();
+        CASE(Loop)
+            countHit(F);
+            PC = Code + PC->B;
+            DISPATCH();
+        CASE(JumpIfFalse) PC = truth(Regs[PC->A].Num) ? PC + 1 : Code + PC->B; DISPATCH();
+        CASE(JumpIfTrue) PC = truth(Regs[PC->A].Num) ? Code + PC->B : PC + 1; DISPATCH();
+        CASE(JumpIfEqK) PC = Regs[PC->A].Num == K[PC->C].Num ? Code + PC->B : PC + 1; DISPATCH();
+        CASE(Call) {
+            CallSite &CS = F.Calls[PC->B];
+            Entry &E = *CS.Callee;
+            const Slot *CallArgs = Regs + PC->C;
+            if (E.Fn)
+                Regs[PC->A] = Run(*E.Fn, CallArgs);
+            else if (void *Addr = NativeAddress(E))
+                Regs[PC->A] = CS.Thunk(Addr, CallArgs);
+            else
+                Aborted = true;
+            if (Aborted)
+                return Slot{};
+        }
+            NEXT();
+        CASE(Ret) return Regs[PC->A];
+#ifndef __GNUC__
+        }
+        return Slot{};
+#endif
+#undef CMP
+#undef ARITH
+#undef NEXT
+#undef CASE
+#undef DISPATCH
+    }
+
+    // One thunk per signature: the arity, which args are strs (bit i for arg
+    // i) and whether a str is returned.
+    template <unsigned Mask, size_t I>
+    using ArgType = std::conditional_t<((Mask >> I) & 1) != 0, const char *, double>;
+
+    template <typename T>
+    static T fromSlot(const Slot &S) {
+        if constexpr (std::is_same_v<T, double>)
+            return S.Num;
+        else
+            return S.Str;
+    }
+
+    template <unsigned Mask, bool RetStr, size_t... I>
+    static Slot callNative(void *Fn, const Slot *Args, std::index_sequence<I...>) {
+        using Ret = std::conditional_t<RetStr, const char *, double>;
+        auto *FP = reinterpret_cast<Ret (*)(ArgType<Mask, I>...)>(Fn);
+        Ret R = FP(fromSlot<ArgType<Mask, I>>(Args[I])...);
+        Slot S{};
+        if constexpr (RetStr)
+            S.Str = R;
+        else
+            S.Num = R;
+        return S;
+    }
+
+    template <size_t N, unsigned Mask, bool RetStr>
+    static Slot thunk(void *Fn, const Slot *Args) {
+        return callNative<Mask, RetStr>(Fn, Args, std::make_index_sequence<N>());
+    }
+
+    template <size_t N, bool RetStr, unsigned... Masks>
+    static constexpr std::array<NativeThunk, sizeof...(Masks)> thunks(std::integer_sequence<unsigned, Masks...>) {
+        return {&thunk<N, Masks, RetStr>...};
+    }
+
+    template <size_t N>
+    static NativeThunk pickThunk(unsigned Mask, bool RetStr) {
+        static constexpr auto Nums = thunks<N, false>(std::make_integer_sequence<unsigned, 1u << N>());
+        static constexpr auto Strs = thunks<N, true>(std::make_integer_sequence<unsigned, 1u << N>());
+        return RetStr ? Strs[Mask] : Nums[Mask];
+    }
+
+    NativeThunk GetThunk(const std::vector<Kind> &Args, Kind Ret) {
+        unsigned Mask = 0;
+        for (size_t i = 0; i < Args.size(); ++i) {
+            if (Args[i] == Kind::Str)
+                Mask |= 1u << i;
+        }
+        bool RetStr = Ret == Kind::Str;
+        static_assert(MaxNativeArgs == 6);
+        switch (Args.size()) {
+            case 0: return pickThunk<0>(Mask, RetStr);
+            case 1: return pickThunk<1>(Mask, RetStr);
+            case 2: return pickThunk<2>(Mask, RetStr);
+            case 3: return pickThunk<3>(Mask, RetStr);
+            case 4: return pickThunk<4>(Mask, RetStr);
+            case 5: return pickThunk<5>(Mask, RetStr);
+            case 6: return pickThunk<6>(Mask, RetStr);
+            default: return nullptr;
+        }
+    }
+}
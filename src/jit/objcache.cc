@@ -0,0 +1,117 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "jit/objcache.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Support/SHA1.h"
+#include "utils/minilog.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Identifiers of modules tagged by tagModule start with this, others are not cached.
+static constexpr llvm::StringLiteral KeyPrefix = "dust-obj-";
+
+ObjectFileCache::ObjectFileCache(std::string Dir, uint64_t MaxSize, std::string TargetId)
+        : Dir(std::move(Dir)), MaxSize(MaxSize), TargetId(std::move(TargetId)) {
+    std::error_code EC;
+    fs::create_directories(this->Dir, EC);
+    if (EC) {
+        minilog::log_error("can not create cache directory {}: {}", this->Dir, EC.message());
+        return;
+    }
+    for (const auto &Entry: fs::directory_iterator(this->Dir, EC)) {
+        if (Entry.path().extension() == ".o")
+            TotalSize += Entry.file_size();
+    }
+    std::lock_guard<std::mutex> Guard(Lock);
+    evict();
+}
+
+std::string ObjectFileCache::pathFor(llvm::StringRef Key) const {
+    return (fs::path(Dir) / (Key.str() + ".o")).string();
+}
+
+bool ObjectFileCache::tagModule(llvm::Module &M, llvm::StringRef Pipeline) {
+    llvm::SmallVector<char, 0> Bitcode;
+    llvm::raw_svector_ostream OS(Bitcode);
+    llvm::WriteBitcodeToFile(M, OS);
+
+    llvm::SHA1 Hash;
+    Hash.update(TargetId);
+    Hash.update(Pipeline);
+    Hash.update(llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(Bitcode.data()), Bitcode.size()));
+    std::string Key = llvm::toHex(Hash.final(), /*LowerCase*/ true);
+    M.setModuleIdentifier((KeyPrefix + Key).str());
+    return fs::exists(pathFor(Key));
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ObjectFileCache::getObject(const llvm::Module *M) {
+    llvm::StringRef Id = M->getModuleIdentifier();
+    if (!Id.consume_front(KeyPrefix))
+        return nullptr;
+    std::string Path = pathFor(Id);
+    auto Buf = llvm::MemoryBuffer::getFile(Path, /*IsText*/ false, /*RequiresNullTerminator*/ false);
+    if (!Buf)
+        return nullptr;
+    // Mark it as recently used for eviction.
+    std::error_code EC;
+    fs::last_write_time(Path, fs::file_time_type::clock::now(), EC);
+    return std::move(*Buf);
+}
+
+void ObjectFileCache::notifyObjectCompiled(const llvm::Module *M, llvm::MemoryBufferRef Obj) {
+    llvm::StringRef Id = M->getModuleIdentifier();
+    if (!Id.consume_front(KeyPrefix))
+        return;
+    std::string Path = pathFor(Id);
+    // Write aside and rename, so a concurrent run never reads half an object.
+    std::string Tmp = Path + ".tmp";
+    {
+        std::ofstream Out(Tmp, std::ios::binary);
+        Out.write(Obj.getBufferStart(), static_cast<std::streamsize>(Obj.getBufferSize()));
+        if (!Out)
+            return;
+    }
+    std::error_code EC;
+    fs::rename(Tmp, Path, EC);
+    if (EC) {
+        fs::remove(Tmp, EC);
+        return;
+    }
+    std::lock_guard<std::mutex> Guard(Lock);
+    TotalSize += Obj.getBufferSize();
+    evict();
+}
+
+void ObjectFileCache::evict() {
+    if (TotalSize <= MaxSize)
+        return;
+    struct Entry {
+        fs::path Path;
+        fs::file_time_type Time;
+        uint64_t Size;
+    };
+    std::vector<Entry> Entries;
+    std::error_code EC;
+    // Recount, overwritten objects and other runs sharing the directory make
+    // the running total drift.
+    TotalSize = 0;
+    for (const auto &E: fs::directory_iterator(Dir, EC)) {
+        if (E.path().extension() == ".o") {
+            Entries.push_back({E.path(), E.last_write_time(EC), E.file_size(EC)});
+            TotalSize += Entries.back().Size;
+        }
+    }
+    std::ranges::sort(Entries, {}, &Entry::Time);
+    for (const auto &E: Entries) {
+        if (TotalSize <= MaxSize)
+            break;
+        if (fs::remove(E.Path, EC))
+            TotalSize -= std::min(TotalSize, E.Size);
+    }
+}
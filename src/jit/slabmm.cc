@@ -0,0 +1,297 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "jit/slabmm.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Process.h"
+#include "utils/minilog.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+using llvm::sys::Memory;
+
+static constexpr uintptr_t HugePageSize = 2 << 20;
+
+SlabAllocator::SlabAllocator(std::shared_ptr<JITMemoryStats> Stats, bool HugePages)
+        : Stats(std::move(Stats)), HugePages(HugePages) {}
+
+SlabAllocator::~SlabAllocator() {
+    for (auto *P: {&CodePool, &DataPool}) {
+        for (auto &MB: P->Slabs)
+            Memory::releaseMappedMemory(MB);
+    }
+}
+
+bool SlabAllocator::mapsCode() {
+    std::lock_guard<std::mutex> Guard(Lock);
+    return !CodePool.Slabs.empty() || grow(CodePool, true, 1, nullptr);
+}
+
+#ifdef __linux__
+// A read-write-execute slab of Size bytes on 2 MB pages. Pages set aside for
+// huge mappings if there are any (Sure is set), else a 2 MB aligned range the
+// kernel is asked to back by transparent huge pages. Empty if neither works.
+static llvm::sys::MemoryBlock mapHuge(uintptr_t Size, void *Hint, bool &Sure) {
+    int Prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+    void *Addr = mmap(Hint, Size, Prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (Addr != MAP_FAILED) {
+        Sure = true;
+        return {Addr, Size};
+    }
+    Sure = false;
+    // Transparent huge pages only back the aligned part of a mapping, map a
+    // page more and trim it to the alignment.
+    void *Raw = mmap(Hint, Size + HugePageSize, Prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (Raw == MAP_FAILED)
+        return {};
+    auto Start = reinterpret_cast<uintptr_t>(Raw);
+    uintptr_t Aligned = llvm::alignTo(Start, HugePageSize);
+    if (Aligned > Start)
+        munmap(Raw, Aligned - Start);
+    if (uintptr_t Tail = Start + HugePageSize - Aligned)
+        munmap(reinterpret_cast<void *>(Aligned + Size), Tail);
+    if (madvise(reinterpret_cast<void *>(Aligned), Size, MADV_HUGEPAGE) != 0) {
+        munmap(reinterpret_cast<void *>(Aligned), Size);
+        return {};
+    }
+    return {reinterpret_cast<void *>(Aligned), Size};
+}
+#endif
+
+bool SlabAllocator::grow(Pool &P, bool Code, uintptr_t MinSize, const uint8_t *Near) {
+    // A huge page per code slab, otherwise enough for a few dozen objects.
+    uintptr_t SlabSize = Code && HugePages ? HugePageSize : 256 << 10;
+    uintptr_t Size = llvm::alignTo(MinSize, SlabSize);
+    unsigned Flags = Memory::MF_READ | Memory::MF_WRITE | (Code ? Memory::MF_EXEC : 0);
+    // Next to the memory asked for, or else the previous slab, to keep the
+    // JIT'd code of a session together. Only a hint, the system may map the
+    // slab anywhere.
+    llvm::sys::MemoryBlock Hint(const_cast<uint8_t *>(Near), 0);
+    if (!Near && !P.Slabs.empty())
+        Hint = P.Slabs.back();
+    const llvm::sys::MemoryBlock *NearBlock = Hint.base() ? &Hint : nullptr;
+    std::error_code EC;
+    llvm::sys::MemoryBlock MB;
+    bool Huge = false, Sure = false;
+    if (Code && HugePages) {
+#ifdef __linux__
+        // LLVM ignores MF_HUGE_HINT outside Windows.
+        MB = mapHuge(Size, Hint.base(), Sure);
+#else
+        MB = Memory::allocateMappedMemory(Size, NearBlock, Flags | Memory::MF_HUGE_HINT, EC);
+#endif
+        Huge = MB.base() != nullptr;
+    }
+    if (!MB.base()) {
+        // No huge pages to be had, fall back to normal ones.
+        EC.clear();
+        MB = Memory::allocateMappedMemory(Size, NearBlock, Flags, EC);
+    }
+    if (EC || !MB.base()) {
+        if (Code && CodePool.Slabs.empty())
+            minilog::log_warning("can not map writable executable JIT memory: {}", EC.message());
+        return false;
+    }
+    P.Slabs.push_back(MB);
+    P.Free[static_cast<uint8_t *>(MB.base())] = MB.allocatedSize();
+    Stats->Reserved += MB.allocatedSize();
+    if (Huge)
+        (Sure ? Stats->Huge : Stats->HugeHinted) += MB.allocatedSize();
+    return true;
+}
+
+static bool within(const uint8_t *Addr, uintptr_t Size, const uint8_t *Near) {
+    if (!Near)
+        return true;
+    auto A = reinterpret_cast<uintptr_t>(Addr), N = reinterpret_cast<uintptr_t>(Near);
+    return A < N ? N - A <= SlabAllocator::MaxDistance : A + Size - N <= SlabAllocator::MaxDistance;
+}
+
+uint8_t *SlabAllocator::allocate(bool Code, uintptr_t Size, unsigned Alignment, const uint8_t *Near) {
+    Alignment = std::max(Alignment, 16u);
+    Size = std::max<uintptr_t>(Size, 1);
+    std::lock_guard<std::mutex> Guard(Lock);
+    Pool &P = Code ? CodePool : DataPool;
+    for (int Attempt = 0; Attempt < 2; ++Attempt) {
+        // First fit, lower addresses first, so objects of a session stay close.
+        for (auto It = P.Free.begin(); It != P.Free.end(); ++It) {
+            auto [Start, Len] = *It;
+            auto *Addr = reinterpret_cast<uint8_t *>(llvm::alignTo(reinterpret_cast<uintptr_t>(Start), Alignment));
+            uintptr_t Pad = Addr - Start;
+            if (Pad + Size > Len || !within(Addr, Size, Near))
+                continue;
+            P.Free.erase(It);
+            if (Pad)
+                P.Free[Start] = Pad;
+            if (Pad + Size < Len)
+                P.Free[Addr + Size] = Len - Pad - Size;
+            Stats->Used += Size;
+            return Addr;
+        }
+        if (!grow(P, Code, Size + Alignment, Near))
+            return nullptr;
+    }
+    return nullptr;
+}
+
+void SlabAllocator::release(bool Code, uint8_t *Addr, uintptr_t Size) {
+    Size = std::max<uintptr_t>(Size, 1);
+    std::lock_guard<std::mutex> Guard(Lock);
+    auto &Free = (Code ? CodePool : DataPool).Free;
+    auto It = Free.emplace(Addr, Size).first;
+    if (auto Next = std::next(It); Next != Free.end() && It->first + It->second == Next->first) {
+        It->second += Next->second;
+        Free.erase(Next);
+    }
+    if (It != Free.begin()) {
+        if (auto Prev = std::prev(It); Prev->first + Prev->second == It->first) {
+            Prev->second += It->second;
+            Free.erase(It);
+        }
+    }
+    Stats->Used -= Size;
+}
+
+SlabMemoryManager::~SlabMemoryManager() {
+    for (auto &A: Allocations)
+        Slabs->release(A.Code, A.Addr, A.Size);
+}
+
+void SlabMemoryManager::reserveAllocationSpace(uintptr_t CodeSize, llvm::Align CodeAlign, uintptr_t RODataSize,
+                                               llvm::Align RODataAlign, uintptr_t RWDataSize,
+                                               llvm::Align RWDataAlign) {
+    // RuntimeDyld sums the sections padded to these alignments, the extra
+    // alignment covers starting the read-write ones after the read-only ones.
+    auto DataAlign = std::max(RODataAlign, RWDataAlign);
+    uintptr_t DataSize = RODataSize + RWDataAlign.value() + RWDataSize;
+    auto *Code = Slabs->allocate(true, CodeSize, CodeAlign.value());
+    if (!Code)
+        return;
+    Allocations.push_back({true, Code, CodeSize});
+    CodeNext = Code;
+    CodeEnd = Code + CodeSize;
+    if (auto *Data = Slabs->allocate(false, DataSize, DataAlign.value(), Code)) {
+        Allocations.push_back({false, Data, DataSize});
+        DataNext = Data;
+        DataEnd = Data + DataSize;
+        return;
+    }
+    // No data slab close enough, put the data right behind the code. The
+    // pages are executable too, but the object links correctly.
+    Slabs->release(true, Code, CodeSize);
+    Allocations.pop_back();
+    uintptr_t Size = llvm::alignTo(CodeSize, DataAlign) + DataSize;
+    Code = Slabs->allocate(true, Size, std::max(CodeAlign, DataAlign).value());
+    if (!Code) {
+        CodeNext = CodeEnd = nullptr;
+        return;
+    }
+    Allocations.push_back({true, Code, Size});
+    CodeNext = Code;
+    CodeEnd = DataNext = Code + llvm::alignTo(CodeSize, DataAlign);
+    DataEnd = Code + Size;
+}
+
+uint8_t *SlabMemoryManager::take(uint8_t *&Next, uint8_t *End, uintptr_t Size, unsigned Alignment) {
+    if (!Next)
+        return nullptr;
+    auto *Addr = reinterpret_cast<uint8_t *>(llvm::alignTo(reinterpret_cast<uintptr_t>(Next), Alignment));
+    if (Addr + Size > End)
+        return nullptr;
+    Next = Addr + Size;
+    return Addr;
+}
+
+uint8_t *SlabMemoryManager::allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned,
+                                                llvm::StringRef) {
+    if (auto *Addr = take(CodeNext, CodeEnd, Size, Alignment))
+        return Addr;
+    // Not covered by the reservation, as close to the rest as the slabs allow.
+    auto *Addr = Slabs->allocate(true, Size, Alignment, DataNext);
+    if (Addr)
+        Allocations.push_back({true, Addr, Size});
+    return Addr;
+}
+
+uint8_t *SlabMemoryManager::allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned,
+                                                llvm::StringRef, bool) {
+    if (auto *Addr = take(DataNext, DataEnd, Size, Alignment))
+        return Addr;
+    auto *Addr = Slabs->allocate(false, Size, Alignment, CodeNext);
+    if (Addr)
+        Allocations.push_back({false, Addr, Size});
+    return Addr;
+}
+
+bool SlabMemoryManager::finalizeMemory(std::string *) {
+    // The permissions were set when the slabs were mapped.
+    for (auto &A: Allocations) {
+        if (A.Code)
+            Memory::InvalidateInstructionCache(A.Addr, A.Size);
+    }
+    return false;
+}
+
+llvm::Expected<std::unique_ptr<CountingMemoryMapper>>
+CountingMemoryMapper::Create(std::shared_ptr<JITMemoryStats> Stats) {
+    auto PageSize = llvm::sys::Process::getPageSize();
+    if (!PageSize)
+        return PageSize.takeError();
+    return std::make_unique<CountingMemoryMapper>(*PageSize, std::move(Stats));
+}
+
+void CountingMemoryMapper::reserve(size_t NumBytes, OnReservedFunction OnReserved) {
+    InProcessMemoryMapper::reserve(NumBytes, [this, OnReserved = std::move(OnReserved)](
+            llvm::Expected<llvm::orc::ExecutorAddrRange> Result) mutable {
+        if (Result) {
+            std::lock_guard<std::mutex> Guard(Lock);
+            Reservations[Result->Start] = Result->size();
+            Stats->Reserved += Result->size();
+        }
+        OnReserved(std::move(Result));
+    });
+}
+
+void CountingMemoryMapper::initialize(AllocInfo &AI, OnInitializedFunction OnInitialized) {
+    uint64_t Size = 0;
+    for (auto &Seg: AI.Segments)
+        Size += Seg.ContentSize + Seg.ZeroFillSize;
+    InProcessMemoryMapper::initialize(AI, [this, Size, OnInitialized = std::move(OnInitialized)](
+            llvm::Expected<llvm::orc::ExecutorAddr> Result) mutable {
+        if (Result) {
+            std::lock_guard<std::mutex> Guard(Lock);
+            Allocations[*Result] = Size;
+            Stats->Used += Size;
+        }
+        OnInitialized(std::move(Result));
+    });
+}
+
+void CountingMemoryMapper::deinitialize(llvm::ArrayRef<llvm::orc::ExecutorAddr> Allocs,
+                                        OnDeinitializedFunction OnDeinitialized) {
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        for (auto Base: Allocs) {
+            if (auto It = Allocations.find(Base); It != Allocations.end()) {
+                Stats->Used -= It->second;
+                Allocations.erase(It);
+            }
+        }
+    }
+    InProcessMemoryMapper::deinitialize(Allocs, std::move(OnDeinitialized));
+}
+
+void CountingMemoryMapper::release(llvm::ArrayRef<llvm::orc::ExecutorAddr> Reservs, OnReleasedFunction OnReleased) {
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        for (auto Base: Reservs) {
+            if (auto It = Reservations.find(Base); It != Reservations.end()) {
+                Stats->Reserved -= It->second;
+                Reservations.erase(It);
+            }
+        }
+    }
+    InProcessMemoryMapper::release(Reservs, std::move(OnReleased));
+}
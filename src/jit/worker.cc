@@ -0,0 +1,144 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "jit/worker.h"
+#include "utils/minilog.h"
+#include "llvm/ExecutionEngine/Orc/SimpleRemoteEPC.h"
+#include "llvm/ExecutionEngine/Orc/TargetProcess/SimpleExecutorDylibManager.h"
+#include "llvm/ExecutionEngine/Orc/TargetProcess/SimpleExecutorMemoryManager.h"
+#include "llvm/ExecutionEngine/Orc/TargetProcess/SimpleRemoteEPCServer.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef LLVM_ON_UNIX
+#include <csignal>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm::orc;
+
+#ifdef LLVM_ON_UNIX
+namespace {
+    // A worker process, its pid is only valid until Reaped.
+    struct WorkerProcess {
+        pid_t Pid;
+        std::mutex Lock;
+        bool Reaped = false;
+    };
+}
+
+// The worker last launched on this thread.
+static thread_local std::shared_ptr<WorkerProcess> LastWorker;
+#endif
+
+llvm::Expected<std::unique_ptr<ExecutorProcessControl>> LaunchWorker() {
+#ifndef LLVM_ON_UNIX
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "workers need fork and pipes");
+#else
+    static std::mutex ForkLock;
+    std::string Exe = llvm::sys::fs::getMainExecutable(nullptr, reinterpret_cast<void *>(&LaunchWorker));
+    int ToWorker[2], FromWorker[2];
+    pid_t Pid;
+    {
+        // Close on exec, so a worker started by another thread at the same
+        // time does not hold this one's pipes open after it is gone.
+        std::lock_guard<std::mutex> Guard(ForkLock);
+        if (pipe(ToWorker) != 0)
+            return llvm::errorCodeToError(std::error_code(errno, std::generic_category()));
+        if (pipe(FromWorker) != 0) {
+            auto EC = std::error_code(errno, std::generic_category());
+            close(ToWorker[0]);
+            close(ToWorker[1]);
+            return llvm::errorCodeToError(EC);
+        }
+        for (int FD: {ToWorker[0], ToWorker[1], FromWorker[0], FromWorker[1]})
+            fcntl(FD, F_SETFD, FD_CLOEXEC);
+        std::string In = std::to_string(ToWorker[0]), Out = std::to_string(FromWorker[1]);
+        Pid = fork();
+        if (Pid == 0) {
+            fcntl(ToWorker[0], F_SETFD, 0);
+            fcntl(FromWorker[1], F_SETFD, 0);
+            execl(Exe.c_str(), Exe.c_str(), "--executor", In.c_str(), Out.c_str(), nullptr);
+            _exit(127);
+        }
+    }
+    close(ToWorker[0]);
+    close(FromWorker[1]);
+    if (Pid < 0) {
+        auto EC = std::error_code(errno, std::generic_category());
+        close(ToWorker[1]);
+        close(FromWorker[0]);
+        return llvm::errorCodeToError(EC);
+    }
+    LastWorker = std::make_shared<WorkerProcess>();
+    LastWorker->Pid = Pid;
+    // Reap the worker once it exits, and tell if it did not exit on its own.
+    // It is waited for first and reaped after, a WorkerDeadline can not kill
+    // another process that got the pid.
+    std::thread([W = LastWorker] {
+        siginfo_t Info{};
+        while (waitid(P_PID, W->Pid, &Info, WEXITED | WNOWAIT) != 0 && errno == EINTR)
+            ;
+        std::lock_guard<std::mutex> Guard(W->Lock);
+        int Status = 0;
+        if (waitpid(W->Pid, &Status, 0) == W->Pid && WIFSIGNALED(Status))
+            minilog::log_error("worker {} was killed by signal {}", W->Pid, WTERMSIG(Status));
+        W->Reaped = true;
+    }).detach();
+
+    return SimpleRemoteEPC::Create<FDSimpleRemoteEPCTransport>(
+            std::make_unique<DynamicThreadPoolTaskDispatcher>(), SimpleRemoteEPC::Setup(),
+            FromWorker[0], ToWorker[1]);
+#endif
+}
+
+int RunWorker(int InFD, int OutFD) {
+    llvm::ExitOnError ExitOnErr("dust worker: ");
+    auto Server = ExitOnErr(SimpleRemoteEPCServer::Create<FDSimpleRemoteEPCTransport>(
+            [](SimpleRemoteEPCServer::Setup &S) -> llvm::Error {
+                S.setDispatcher(std::make_unique<SimpleRemoteEPCServer::ThreadDispatcher>());
+                // Writing memory and registering eh-frames.
+                S.bootstrapSymbols() = SimpleRemoteEPCServer::defaultBootstrapSymbols();
+                // Memory for the linked code, and symbol lookup in this
+                // process for the runtime fns (printd, ...).
+                S.services().push_back(std::make_unique<rt_bootstrap::SimpleExecutorMemoryManager>());
+                S.services().push_back(std::make_unique<rt_bootstrap::SimpleExecutorDylibManager>());
+                return llvm::Error::success();
+            },
+            InFD, OutFD));
+    ExitOnErr(Server->waitForDisconnect());
+    return 0;
+}
+
+WorkerDeadline::WorkerDeadline(unsigned Seconds) {
+#ifdef LLVM_ON_UNIX
+    if (!Seconds || !LastWorker)
+        return;
+    Watch = std::thread([this, Seconds, W = LastWorker] {
+        std::unique_lock<std::mutex> Guard(Lock);
+        if (Cancel.wait_for(Guard, std::chrono::seconds(Seconds), [this] { return Over; }))
+            return;
+        std::lock_guard<std::mutex> WorkerGuard(W->Lock);
+        if (!W->Reaped) {
+            Expired = true;
+            kill(W->Pid, SIGKILL);
+        }
+    });
+#endif
+}
+
+WorkerDeadline::~WorkerDeadline() {
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        Over = true;
+    }
+    Cancel.notify_one();
+    if (Watch.joinable())
+        Watch.join();
+}
@@ -6,11 +6,11 @@
 #include <cctype>
 
 namespace dust::lexer{
-    std::vector<Token> tokens;
-    size_t tokIndex = 0;
+    thread_local std::vector<Token> tokens;
+    thread_local size_t tokIndex = 0;
     bool isBound(char ch) {
         return ch == '(' || ch == ')' || ch == '[' || ch == ']' || ch == '{' || ch == '}' || ch == ',' || ch == ':' ||
-               ch == ';';
+               ch == ';' || ch == '.';
     }
     
     bool isOperator(char id) {
@@ -61,6 +61,20 @@ namespace dust::lexer{
             return {VAR_TK, ""};
         }else if (str == "str") {
             return {STR_TK, ""};
+        }else if (str == "const") {
+            return {CONST_TK, ""};
+        }else if (str == "match") {
+            return {MATCH_TK, ""};
+        }else if (str == "struct") {
+            return {STRUCT_TK, ""};
+        }else if (str == "gen") {
+            return {GEN_TK, ""};
+        }else if (str == "yield") {
+            return {YIELD_TK, ""};
+        }else if (str == "in") {
+            return {IN_TK, ""};
+        }else if (str == "import") {
+            return {IMPORT_TK, ""};
         } else if (str == "(") {
             return {LPAR_TK, ""};
         } else if (str == ")") {
@@ -79,6 +93,8 @@ namespace dust::lexer{
             return {COMMA_TK, ""};
         } else if (str == ";") {
             return {SEMICON_TK, ""};
+        } else if (str == ".") {
+            return {DOT_TK, ""};
         } else if (str == "+") {
             return {ADD_TK, ""};
         } else if (str == "+=") {
@@ -113,8 +129,14 @@ namespace dust::lexer{
             return {NOTEQ_TK, ""};
         } else if (str == "!") {
             return {NOT_TK, ""};
+        } else if (str == "&&") {
+            return {AND_TK, ""};
+        } else if (str == "||") {
+            return {OR_TK, ""};
         }else if (str == "=") {
             return {ASSIGN_TK, ""};
+        }else if (str == "=>") {
+            return {ARROW_TK, ""};
         } else if (isString(str)) {
             std::string literal = str.substr(1, str.size() - 2);
 //            minilog::log_debug("lexer phase: {}",literal);
@@ -167,14 +189,20 @@ namespace dust::lexer{
                     }
                     continue;
                 }
-                // check if it is operators, such as +=, <=, of just +, -, >
+                // check if it is operators, such as +=, <=, =>, of just +, -, >
                 if (isOperator(ch) || ch == '!') {
                     char next = source.peek();
-                    if (next == '=') {
+                    if (next == '=' || (ch == '=' && next == '>')) {
                         source.get();
                         buf += next;
                     }
                     lexBuf();
+                } else if (ch == '&' || ch == '|') {
+                    // only the doubled forms && and || exist
+                    if (source.peek() == ch) {
+                        buf += (char) source.get();
+                    }
+                    lexBuf();
                 } else if (isBound(ch)) {
                     lexBuf();
                 }
@@ -1,24 +1,112 @@
 #include <iostream>
 #include "lexer/lexer.h"
+#include <atomic>
 #include <map>
+#include <thread>
 #include "parser/parser.h"
+#include "code/gen.h"
+#include "engine/engine.h"
+#include "jit/worker.h"
+#include "server/server.h"
+#include "utils/options.h"
 using namespace dust;
 
+// Compile every source file on a thread with an engine of its own, each
+// running its code in a worker, Opts.Workers files at a time.
+static int runInWorkers() {
+    std::vector<std::string> Files{Opts.Source};
+    Files.insert(Files.end(), Opts.Scripts.begin(), Opts.Scripts.end());
+    const Options Shared = Opts;
+    std::atomic<size_t> Next = 0;
+    std::atomic<bool> Failed = false;
+    std::vector<std::thread> Threads;
+    for (size_t i = 0; i < std::min<size_t>(Shared.Workers, Files.size()); ++i) {
+        Threads.emplace_back([&] {
+            for (size_t F = Next++; F < Files.size(); F = Next++) {
+                Options O = Shared;
+                O.Source = Files[F];
+                O.Scripts.clear();
+                auto TheEngine = Engine::Create(O);
+                if (!TheEngine) {
+                    Failed = true;
+                    continue;
+                }
+                std::ifstream source{O.Source};
+                if (!source) {
+                    minilog::log_error("can not read {}", O.Source);
+                    Failed = true;
+                    continue;
+                }
+                unsigned Errors = minilog::error_count();
+                WorkerDeadline Deadline(O.Timeout);
+                lexer::tokens = lexer::lexFile(source);
+                parser::SetParseMode(parser::File);
+                parser::MainLoop();
+                // Items that failed are skipped, a worker that died ends its
+                // script (see RunJITCode), the other scripts go on either way.
+                if (Deadline.expired())
+                    minilog::log_error("{} ran out of its {} seconds", O.Source, O.Timeout);
+                if (minilog::error_count() != Errors) {
+                    minilog::log_error("{} failed", O.Source);
+                    Failed = true;
+                }
+            }
+        });
+    }
+    for (auto &T: Threads)
+        T.join();
+    return Failed ? 1 : 0;
+}
+
 int main(int argc, char **argv) {
-    llvm::InitializeNativeTarget();
-    llvm::InitializeNativeTargetAsmPrinter();
-    llvm::InitializeNativeTargetAsmParser();
-    parser::TheJIT = DustJIT::Create();
-    parser::InitModuleAndManagers();
-    if(argc>1){
-        std::ifstream source{argv[1]};
+    if (!ParseOptions(argc, argv)) {
+        return 1;
+    }
+    // The client only forwards, it needs none of the compiler.
+    if (!Opts.ClientSocket.empty()) {
+        return server::RunClient(Opts.ClientSocket, Opts.Source);
+    }
+    if (Opts.WorkerIn >= 0) {
+        return RunWorker(Opts.WorkerIn, Opts.WorkerOut);
+    }
+    if (Opts.Workers) {
+        return runInWorkers();
+    }
+    auto TheEngine = Engine::Create(Opts);
+    if (!TheEngine) {
+        return 1;
+    }
+    if (!Opts.ServeSocket.empty()) {
+        return server::Serve(Opts.ServeSocket);
+    }
+    if(!Opts.Source.empty()){
+        std::ifstream source{Opts.Source};
         lexer::tokens = lexer::lexFile(source);
         parser::SetParseMode(parser::File);
+        if (Opts.Output != Options::OutputKind::JIT) {
+            // The JIT above only lends its data layout and tuning, nothing runs.
+            return code::CompileProgram();
+        }
     }else{
         parser::SetParseMode(parser::Interactive);
     }
     parser::MainLoop();
+    if (!Opts.ProfileGenerate.empty()) {
+        parser::WriteProfile(Opts.ProfileGenerate);
+    }
+    bool LatencyMet = !Opts.Latency || parser::PrintLatencyStats();
+    if (Opts.MemStats) {
+        auto &Stats = parser::TheJIT->getMemoryStats();
+        fprintf(stderr, "JIT memory: %llu KiB reserved, %llu KiB used\n",
+                static_cast<unsigned long long>(Stats.Reserved >> 10),
+                static_cast<unsigned long long>(Stats.Used >> 10));
+        if (Opts.HugePages) {
+            fprintf(stderr, "JIT code on huge pages: %llu KiB, %llu KiB more asked for\n",
+                    static_cast<unsigned long long>(Stats.Huge >> 10),
+                    static_cast<unsigned long long>(Stats.HugeHinted >> 10));
+        }
+    }
     
 
-    return 0;
+    return LatencyMet ? 0 : 1;
 }
@@ -0,0 +1,78 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "parser/parser.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include <format>
+
+namespace dust::parser{
+    std::string BatchFunction(const std::string &Name) {
+        llvm::StringRef Bitcode = GetFunctionIR(Name);
+        if (Bitcode.empty()) {
+            minilog::log_error("{} has no recorded IR to batch, it must be JIT'd with Opts.Batch", Name);
+            return "";
+        }
+        auto Ctx = std::make_unique<llvm::LLVMContext>();
+        auto M = llvm::parseBitcodeFile(llvm::MemoryBufferRef(Bitcode, Name), *Ctx);
+        if (!M) {
+            minilog::log_error("can not read the IR of {}: {}", Name, llvm::toString(M.takeError()));
+            return "";
+        }
+        llvm::Function *F = (*M)->getFunction(Name);
+        // Every arg is read from a column and the result stored to one.
+        if (!F || !F->getReturnType()->isDoubleTy() ||
+            !std::ranges::all_of(F->args(), [](llvm::Argument &A) { return A.getType()->isDoubleTy(); })) {
+            minilog::log_error("only fns taking and returning nums can be batched, {} can not", Name);
+            return "";
+        }
+        // Batches of a redefined fn run the body they were made from.
+        std::string Batch = std::format("{}${}$batch", Name, Definitions[Name]);
+        // A private copy of the body to inline into the loop, its recursive
+        // calls stay in the copy.
+        F->setName(Batch + ".body");
+        F->setLinkage(llvm::GlobalValue::InternalLinkage);
+        F->addFnAttr(llvm::Attribute::AlwaysInline);
+
+        // void Batch(double **Columns, double *Out, i64 Rows)
+        llvm::IRBuilder<> B(*Ctx);
+        auto *PtrTy = llvm::PointerType::getUnqual(*Ctx);
+        auto *Fn = llvm::Function::Create(
+                llvm::FunctionType::get(B.getVoidTy(), {PtrTy, PtrTy, B.getInt64Ty()}, false),
+                llvm::Function::ExternalLinkage, Batch, M->get());
+        llvm::Argument *Columns = Fn->getArg(0), *Out = Fn->getArg(1), *Rows = Fn->getArg(2);
+        // Out overlaps no column, without this the vectorized loop would be
+        // guarded by overlap checks.
+        Out->addAttr(llvm::Attribute::NoAlias);
+        auto *Entry = llvm::BasicBlock::Create(*Ctx, "entry", Fn);
+        auto *Loop = llvm::BasicBlock::Create(*Ctx, "loop", Fn);
+        auto *Exit = llvm::BasicBlock::Create(*Ctx, "exit", Fn);
+
+        B.SetInsertPoint(Entry);
+        std::vector<llvm::Value *> Cols;
+        for (unsigned i = 0; i < F->arg_size(); ++i)
+            Cols.push_back(B.CreateLoad(PtrTy, B.CreateConstGEP1_64(PtrTy, Columns, i)));
+        B.CreateCondBr(B.CreateICmpEQ(Rows, B.getInt64(0)), Exit, Loop);
+
+        B.SetInsertPoint(Loop);
+        auto *Row = B.CreatePHI(B.getInt64Ty(), 2, "row");
+        Row->addIncoming(B.getInt64(0), Entry);
+        std::vector<llvm::Value *> Args;
+        for (auto *Col: Cols)
+            Args.push_back(B.CreateLoad(B.getDoubleTy(), B.CreateGEP(B.getDoubleTy(), Col, Row)));
+        B.CreateStore(B.CreateCall(F, Args), B.CreateGEP(B.getDoubleTy(), Out, Row));
+        llvm::Value *Next = B.CreateAdd(Row, B.getInt64(1));
+        Row->addIncoming(Next, Loop);
+        B.CreateCondBr(B.CreateICmpULT(Next, Rows), Loop, Exit);
+
+        B.SetInsertPoint(Exit);
+        B.CreateRetVoid();
+
+        // Inlines the body, after which the loop vectorizes across rows as
+        // far as the body allows (no calls left, no early returns in loops).
+        OptimizeModule(**M, llvm::OptimizationLevel::O3);
+        if (JITFailed(TheJIT->addModule(llvm::orc::ThreadSafeModule(std::move(*M), std::move(Ctx))), Batch))
+            return "";
+        return Batch;
+    }
+}
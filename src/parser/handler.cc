@@ -4,25 +4,131 @@
 
 #include "parser/parser.h"
 #include "ast/expr.h"
+#include "code/snapshot.h"
+#include "code/unit.h"
+#include "interp/interp.h"
 #include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "utils/options.h"
+#include <algorithm>
+#include <chrono>
+#include <format>
 
 namespace dust::parser{
+    static bool sameSignature(const PrototypeAST &A, const PrototypeAST &B) {
+        auto SameType = [](const Variable &X, const Variable &Y) {
+            return X.typeId == Y.typeId && X.typeName == Y.typeName;
+        };
+        return A.getRetType() == B.getRetType() && A.getRetTypeName() == B.getRetTypeName() &&
+               std::ranges::equal(A.getArgs(), B.getArgs(), SameType);
+    }
+    
+    // Whether every fn F calls is defined by now: in the session, by the host
+    // or by the runtime. Linking a body against an extern defined later fails,
+    // and ORC keeps that failure for its symbols, so such a body is only
+    // compiled once it is first called.
+    static bool calleesDefined(llvm::Function &F) {
+        for (auto &Callee: F.getParent()->functions()) {
+            if (!Callee.isDeclaration() || Callee.isIntrinsic() || Callee.use_empty())
+                continue;
+            std::string Name = Callee.getName().str();
+            if (Definitions.contains(Name) || TheJIT->hasHostFunction(Name))
+                continue;
+            // A worker's runtime can not be searched from here.
+            if (TheJIT->isRemote() || !llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(Name))
+                return false;
+        }
+        return true;
+    }
+    
+    void JITFunction(FunctionAST &fnAST) {
+        auto Name = fnAST.getProto().getName();
+        UseOwnContext();
+        if (auto *fnIR = fnAST.codegen()) {
+            if (Opts.Echo) {
+                fprintf(stderr, "Read function definition:");
+                fnIR->print(llvm::errs());
+                fprintf(stderr, "\n");
+            }
+            if (!Opts.ProfileUse.empty()) {
+                // The weights only pay off in the full pipeline: block
+                // layout, inlining and splitting go by them. With the bodies
+                // of the fns defined so far, hot calls to them inline too.
+                ImportCallees(*TheModule);
+                OptimizeModule(*TheModule, llvm::OptimizationLevel::O2);
+            } else {
+                LowerCoroutines();
+            }
+            llvm::SmallVector<char, 0> Bitcode;
+            if (Opts.Specialize || Opts.Tiered || Opts.Batch || !Opts.ProfileUse.empty()) {
+                Bitcode = ModuleBitcode();
+            }
+            unsigned Version = ++Versions[Name];
+            bool Prefetch = calleesDefined(*fnIR);
+            llvm::Error Err = llvm::Error::success();
+            if (TheJIT->hasStubs()) {
+                // Every definition is a body of its own, Name is the stub
+                // leading to the latest one.
+                std::string Impl = std::format("{}${}", Name, Version);
+                fnIR->setName(Impl);
+                if (Opts.Tiered) {
+                    // The recorded IR is left uninstrumented for the O3 recompile.
+                    InstrumentTier0(*fnIR);
+                }
+                Err = TheJIT->defineFunction(Name, Impl, TakeModule()).takeError();
+            } else {
+                Err = TheJIT->addModule(TakeModule());
+            }
+            InitModuleAndManagers();
+            // Calls still go to the previous body, if there is one.
+            if (JITFailed(std::move(Err), Name))
+                return;
+            ++Definitions[Name];
+            // Only now, tier-ups, clones and batches never start from a body
+            // the JIT refused.
+            if (!Bitcode.empty())
+                RecordFunctionIR(Name, std::move(Bitcode));
+            // Compile it on the JIT's threads while we parse on.
+            if (Prefetch)
+                TheJIT->prefetch(Name);
+        }else{
+            minilog::log_error("handle func error");
+            return;
+        }
+        if (Opts.Interp) {
+            // Bytecode callers go to the compiled body from now on.
+            interp::ForgetFunction(Name);
+        }
+    }
     
     void InterpretFuncDef() {
 //        minilog::log_info("handle func def");
         if (auto fnAST = parseFuncDef()) {
+            // Generic fns are only compiled once instantiated by a call.
+            if (fnAST->getProto().isGeneric()) {
+                auto Name = fnAST->getProto().getName();
+                if (Opts.Echo)
+                    fprintf(stderr, "Read generic function definition: %s\n", Name.c_str());
+                GenericFuncs[Name] = std::move(fnAST);
+                return;
+            }
             
-            if (auto *fnIR = fnAST->codegen()) {
-                fprintf(stderr, "Read function definition:");
-                fnIR->print(llvm::errs());
-                fprintf(stderr, "\n");
-                ExitOnErr(TheJIT->addModule(
-                        ThreadSafeModule(std::move(TheModule), std::move(TheContext))));
-                InitModuleAndManagers();
-            }else{
-                minilog::log_fatal("handle func error");
-                std::exit(10);
+            auto Name = fnAST->getProto().getName();
+            if (Definitions.contains(Name)) {
+                // Callers were compiled against the signature, only the body may change.
+                if (!TheJIT->hasStubs()) {
+                    minilog::log_error("{} is already defined, fns can not be redefined in lazy mode", Name);
+                    return;
+                }
+                if (!sameSignature(*FunctionProtos[Name], fnAST->getProto())) {
+                    minilog::log_error("redefinition of {} changes its signature", Name);
+                    return;
+                }
             }
+            
+            if (Opts.Interp && interp::DefineFunction(fnAST))
+                return;
+            JITFunction(*fnAST);
 
 //            minilog::log_info("handle func def done");
             
@@ -33,30 +139,66 @@ namespace dust::parser{
         
     }
     
+    bool RunJITCode(llvm::orc::ExecutorAddr Fn) {
+        if (auto Err = TheJIT->run(Fn)) {
+            // The worker is gone, and the rest of the script with it.
+            minilog::log_error("{} stopped: {}", Opts.Source, llvm::toString(std::move(Err)));
+            lexer::tokIndex = lexer::tokens.size();
+            return false;
+        }
+        return true;
+    }
+    
+    bool JITFailed(llvm::Error Err, const std::string &What) {
+        if (!Err)
+            return false;
+        minilog::log_error("can not JIT {}: {}", What, llvm::toString(std::move(Err)));
+        return true;
+    }
+    
+    // JIT the __anon_expr function in TheModule, run it once and free it again.
+    void RunAnonExpr() {
+        // Create a ResourceTracker to track JIT'd memory allocated to our
+        // anonymous expression -- that way we can free it after executing.
+        auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+        
+        LowerCoroutines();
+        if (!JITFailed(TheJIT->addModule(TakeModule(), RT), "top-level expression")) {
+            // Search the JIT for the __anon_expr symbol. The module is compiled
+            // on a pool thread holding the lock of ReplContext, which is only
+            // taken again (by InitModuleAndManagers) once the module is gone.
+            auto ExprSymbol = TheJIT->lookup("__anon_expr");
+            
+            bool Remove = true;
+            if (!ExprSymbol)
+                JITFailed(ExprSymbol.takeError(), "top-level expression");
+            else // It takes no arguments and returns nothing.
+                Remove = RunJITCode(ExprSymbol->getAddress());
+            // Delete the anonymous expression module from the JIT, unless
+            // the worker holding it is gone.
+            if (Remove)
+                JITFailed(RT->remove(), "top-level expression");
+        }
+//        fprintf(stderr, "Evaluated to %f\n", FP());
+        InitModuleAndManagers();
+    }
+    
+    // Time from parsed input to finished evaluation, in milliseconds.
+    static thread_local std::vector<double> Latencies;
+    
     void InterpretTopLevelExpr() {
         // Evaluate a top-level expression into an anonymous function.
         if (auto FnAST = parseTopLevelExpr()) {
-            if (FnAST->codegen()) {
-                // Create a ResourceTracker to track JIT'd memory allocated to our
-                // anonymous expression -- that way we can free it after executing.
-                auto RT = TheJIT->getMainJITDylib().createResourceTracker();
-                
-                auto TSM = llvm::orc::ThreadSafeModule(std::move(TheModule), std::move(TheContext));
-                ExitOnErr(TheJIT->addModule(std::move(TSM), RT));
-                InitModuleAndManagers();
-                
-                // Search the JIT for the __anon_expr symbol.
-                auto ExprSymbol = ExitOnErr(TheJIT->lookup("__anon_expr"));
-                
-                // Get the symbol's address and cast it to the right type (takes no
-                // arguments, returns a double) so we can call it as a native function.
-                void (*FP)() = ExprSymbol.getAddress().toPtr < void(*)
-                () > ();
-                FP();
-//                fprintf(stderr, "Evaluated to %f\n", FP());
-                
-                // Delete the anonymous expression module from the JIT.
-                ExitOnErr(RT->remove());
+            auto Start = std::chrono::steady_clock::now();
+            bool Done = Opts.Interp && interp::RunTopLevel(*FnAST);
+            if (!Done)
+                Done = Opts.Specialize && RunSpecialized(*FnAST);
+            if (!Done && FnAST->codegen()) {
+                RunAnonExpr();
+            }
+            if (Opts.Latency) {
+                Latencies.push_back(
+                        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count());
             }
         } else {
             // Skip token for error recovery.
@@ -65,13 +207,108 @@ namespace dust::parser{
         }
     }
 
+    bool PrintLatencyStats() {
+        if (Latencies.empty())
+            return true;
+        std::vector<double> Sorted = Latencies;
+        std::ranges::sort(Sorted);
+        auto At = [&](double Q) { return Sorted[static_cast<size_t>(Q * (Sorted.size() - 1))]; };
+        bool Met = At(0.5) < LatencyTarget;
+        fprintf(stderr, "top-level evaluations: %zu, median %.3f ms, p90 %.3f ms, max %.3f ms (target %.1f ms %s)\n",
+                Sorted.size(), At(0.5), At(0.9), Sorted.back(), LatencyTarget, Met ? "met" : "missed");
+        return Met;
+    }
+    
+    void InterpretGlobalVar() {
+        auto globals = parseGlobalVar();
+        if (globals.empty()) {
+            minilog::log_info("error with global var");
+            PassToken();
+            return;
+        }
+        for (auto &G: globals) {
+            std::string Name = G->getName();
+            if (GlobalVars.contains(Name)) {
+                minilog::log_error("global {} is already defined", Name);
+                continue;
+            }
+            UseOwnContext();
+            auto *GV = G->codegen();
+            if (!GV) {
+                minilog::log_error("handle global var error");
+                continue;
+            }
+            if (Opts.Echo) {
+                fprintf(stderr, "Read global variable:");
+                GV->print(llvm::errs());
+                fprintf(stderr, "\n");
+            }
+            // Definitions go to their own dylib, every later module links against it.
+            auto Err = TheJIT->addGlobalsModule(TakeModule());
+            InitModuleAndManagers();
+            if (JITFailed(std::move(Err), Name))
+                continue;
+            
+            bool needsInit = G->hasInit() && !G->hasLiteralInit();
+            auto &Decl = GlobalVars[Name] = std::move(G);
+            if (needsInit && Decl->codegenInit()) {
+                RunAnonExpr();
+            }
+        }
+    }
+    
+    void InterpretStruct() {
+        auto decl = parseStructDef();
+        if (StructDecls.contains(decl->getName())) {
+            minilog::log_error("struct {} is already defined", decl->getName());
+            return;
+        }
+        // Fields are held by value, so a field may only use structs declared before.
+        for (const auto &F: decl->getFields()) {
+            if (F.typeId == lexer::IDENT_TK && !StructDecls.contains(F.typeName)) {
+                minilog::log_error("field {} of {} has unknown type {}", F.name, decl->getName(), F.typeName);
+                return;
+            }
+        }
+        auto *ST = decl->codegen();
+        if (Opts.Echo) {
+            fprintf(stderr, "Read struct:");
+            ST->print(llvm::errs());
+            fprintf(stderr, "\n");
+        }
+        StructDecls[decl->getName()] = std::move(decl);
+    }
+    
+    void InterpretGenDef() {
+        auto gen = parseGenDef();
+        auto &proto = gen->getProto();
+        if (proto.isGeneric()) {
+            minilog::log_error("generator {} needs a type for every parameter", proto.getName());
+            return;
+        }
+        if (FunctionProtos.contains(proto.getName()) || GenericFuncs.contains(proto.getName())) {
+            minilog::log_error("{} is already defined as a function", proto.getName());
+            return;
+        }
+        // Nothing is compiled yet, every module with a for-in over it gets its own copy.
+        if (Opts.Echo)
+            fprintf(stderr, "Read generator definition: %s\n", proto.getName().c_str());
+        Generators[proto.getName()] = std::move(gen);
+    }
+    
     void InterpretExtern() {
 //        minilog::log_info("handle extern");
         if (auto proto = parseExtern()) {
+            if (proto->isGeneric()) {
+                minilog::log_error("extern {} needs a type for every parameter", proto->getName());
+                return;
+            }
             if (auto *protoIR = proto->codegen()) {
-                fprintf(stderr, "Read top-level expression:");
-                protoIR->print(llvm::errs());
-                fprintf(stderr, "\n");
+                if (Opts.Echo) {
+                    fprintf(stderr, "Read top-level expression:");
+                    protoIR->print(llvm::errs());
+                    fprintf(stderr, "\n");
+                }
                 FunctionProtos[proto->getName()] = std::move(proto);
             }
 //            minilog::log_info("handle extern done");
@@ -83,43 +320,94 @@ namespace dust::parser{
     
     
     void CompileFuncDef() {
-        minilog::log_info("handle func def");
         if (auto fnAST = parseFuncDef()) {
-            
-            if (auto *fnIR = fnAST->codegen()) {
-                fprintf(stderr, "Read function definition:");
-                fnIR->print(llvm::errs());
-                fprintf(stderr, "\n");
+            if (fnAST->getProto().isGeneric()) {
+                GenericFuncs[fnAST->getProto().getName()] = std::move(fnAST);
+                return;
+            }
+            if (!fnAST->codegen()) {
+                minilog::log_error("handle func error");
             }
-            minilog::log_info("handle func def done");
-            
         } else {
-            minilog::log_info("error with func def");
             PassToken();//skip token for error recovery
         }
     }
     
-    void CompileTopLevelExpr() {
+    llvm::Function *CompileTopLevelExpr() {
         // Evaluate a top-level expression into an anonymous function.
         if (auto FnAST = parseTopLevelExpr()) {
-            FnAST->codegen();
-        } else {
-            // Skip token for error recovery.
-            minilog::log_info("error with top level expr");
+            return FnAST->codegen();
+        }
+        // Skip token for error recovery.
+        minilog::log_info("error with top level expr");
+        PassToken();
+        return nullptr;
+    }
+    
+    std::vector<llvm::Function *> CompileGlobalVar() {
+        std::vector<llvm::Function *> Inits;
+        auto globals = parseGlobalVar();
+        if (globals.empty()) {
+            minilog::log_info("error with global var");
             PassToken();
+            return Inits;
         }
+        for (auto &G: globals) {
+            std::string Name = G->getName();
+            if (GlobalVars.contains(Name)) {
+                minilog::log_error("global {} is already defined", Name);
+                continue;
+            }
+            if (!G->codegen()) {
+                minilog::log_error("handle global var error");
+                continue;
+            }
+            bool needsInit = G->hasInit() && !G->hasLiteralInit();
+            auto &Decl = GlobalVars[Name] = std::move(G);
+            if (needsInit) {
+                if (auto *F = Decl->codegenInit())
+                    Inits.push_back(F);
+            }
+        }
+        return Inits;
+    }
+    
+    void InterpretImport() {
+        std::string File = parseImport();
+        if (File.empty()) {
+            PassToken();
+            return;
+        }
+        std::string Image = code::UnitImage(code::ResolveImport(File));
+        if (Image.empty() || !code::LoadUnit(Image))
+            minilog::log_error("can not import {}", File);
+    }
+    
+    void CompileImport() {
+        std::string File = parseImport();
+        if (File.empty()) {
+            PassToken();
+            return;
+        }
+        if (Opts.Output != Options::OutputKind::Snapshot) {
+            // The unit's code is in its image, which only the JIT links.
+            minilog::log_error("import {} needs --snapshot or the JIT", File);
+            return;
+        }
+        std::string Image = code::UnitImage(code::ResolveImport(File));
+        if (Image.empty() || !code::DeclareUnit(Image))
+            minilog::log_error("can not import {}", File);
     }
     
     void CompileExtern() {
-        minilog::log_info("handle extern");
         if (auto proto = parseExtern()) {
-            if (auto *protoIR = proto->codegen()) {
-                fprintf(stderr, "Read top-level expression:");
-                protoIR->print(llvm::errs());
-                fprintf(stderr, "\n");
+            if (proto->isGeneric()) {
+                minilog::log_error("extern {} needs a type for every parameter", proto->getName());
+                return;
+            }
+            if (proto->codegen()) {
                 FunctionProtos[proto->getName()] = std::move(proto);
             }
-            minilog::log_info("handle extern done");
         } else {
             minilog::log_info("error with extern");
             PassToken();
@@ -3,60 +3,246 @@
 //
 
 #include "ast/expr.h"
+#include "ast/global.h"
+#include "ast/struct.h"
+#include "ast/func.h"
+#include "ast/generator.h"
+#include "code/snapshot.h"
+#include "interp/interp.h"
 #include "jit/dustjit.h"
+#include "parser/parser.h"
+#include "parser/scope.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Transforms/IPO/HotColdSplitting.h"
+#include <optional>
 
 namespace dust::parser{
     using namespace ast;
-    std::unique_ptr<llvm::LLVMContext> TheContext;
-    std::unique_ptr<llvm::IRBuilder<>> Builder;
-    std::unique_ptr<llvm::Module> TheModule;
-    std::map<std::string, std::pair<llvm::AllocaInst *,llvm::Type*>>  NamedValues;
-    std::unique_ptr<DustJIT> TheJIT;
-    std::unique_ptr<llvm::FunctionPassManager> TheFPM;
-    std::unique_ptr<llvm::LoopAnalysisManager> TheLAM;
-    std::unique_ptr<llvm::FunctionAnalysisManager> TheFAM;
-    std::unique_ptr<llvm::CGSCCAnalysisManager> TheCGAM;
-    std::unique_ptr<llvm::ModuleAnalysisManager> TheMAM;
-    std::unique_ptr<llvm::PassInstrumentationCallbacks> ThePIC;
-    std::unique_ptr<llvm::StandardInstrumentations> TheSI;
-    std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
-    llvm::ExitOnError ExitOnErr;
+    thread_local llvm::orc::ThreadSafeContext TheTSContext;
+    thread_local llvm::LLVMContext *TheContext = nullptr;
+    thread_local std::unique_ptr<llvm::IRBuilder<>> Builder;
+    thread_local std::unique_ptr<llvm::Module> TheModule;
+    thread_local ScopedSymbolTable NamedValues;
+    thread_local std::unique_ptr<DustJIT> TheJIT;
+    thread_local std::unique_ptr<llvm::FunctionPassManager> TheFPM;
+    thread_local std::unique_ptr<llvm::LoopAnalysisManager> TheLAM;
+    thread_local std::unique_ptr<llvm::FunctionAnalysisManager> TheFAM;
+    thread_local std::unique_ptr<llvm::CGSCCAnalysisManager> TheCGAM;
+    thread_local std::unique_ptr<llvm::ModuleAnalysisManager> TheMAM;
+    thread_local std::unique_ptr<llvm::PassInstrumentationCallbacks> ThePIC;
+    thread_local std::unique_ptr<llvm::StandardInstrumentations> TheSI;
+    thread_local std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+    thread_local std::map<std::string, std::unique_ptr<GlobalVarAST>> GlobalVars;
+    thread_local std::map<std::string, std::unique_ptr<StructAST>> StructDecls;
+    thread_local std::map<std::string, std::unique_ptr<FunctionAST>> GenericFuncs;
+    thread_local std::map<std::string, std::unique_ptr<GeneratorAST>> Generators;
+    thread_local std::map<std::string, unsigned> Definitions;
+    thread_local std::map<std::string, unsigned> Versions;
+    thread_local GeneratorState *CurGenerator = nullptr;
+    thread_local std::vector<llvm::Value *> OpenGenerators;
+    thread_local llvm::ExitOnError ExitOnErr;
     
-    void InitModuleAndManagers() {
-        // Open a new context and module.
-        TheContext = std::make_unique<llvm::LLVMContext>();
-        TheModule = std::make_unique<llvm::Module>("DustJIT", *TheContext);
-        TheModule->setDataLayout(TheJIT->getDataLayout());
-        
-        // Create a new builder for the module.
-        Builder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
-        
-        // Create new pass and analysis managers.
+    static void addFunctionPasses(llvm::FunctionPassManager &FPM) {
+        // Split struct and scalar locals out of their allocas into registers.
+        FPM.addPass(llvm::SROAPass(llvm::SROAOptions::ModifyCFG));
+        // Do simple "peephole" optimizations and bit-twiddling optzns.
+        FPM.addPass(llvm::InstCombinePass());
+        // Reassociate expressions.
+        FPM.addPass(llvm::ReassociatePass());
+        // Eliminate Common SubExpressions.
+        FPM.addPass(llvm::GVNPass());
+        // Simplify the control flow graph (deleting unreachable blocks, etc.).
+        FPM.addPass(llvm::SimplifyCFGPass());
+    }
+    
+    // The passes of addFunctionPasses as text, part of the key of every cached
+    // object: a change to them, or to LLVM, makes different code of the same IR.
+    static const std::string &functionPipeline() {
+        static const std::string Pipeline = [] {
+            llvm::FunctionPassManager FPM;
+            addFunctionPasses(FPM);
+            std::string Text;
+            llvm::raw_string_ostream OS(Text);
+            FPM.printPipeline(OS, [](llvm::StringRef Name) { return Name; });
+            return OS.str() + " llvm " LLVM_VERSION_STRING;
+        }();
+        return Pipeline;
+    }
+    
+    // Top-level expressions are compiled, run and dropped one at a time, so they
+    // all share this context instead of paying for a new one on every line.
+    static thread_local llvm::orc::ThreadSafeContext ReplContext;
+    // Held while this thread generates IR into ReplContext. The JIT locks
+    // the context while it compiles or frees a module, possibly on a pool thread.
+    static thread_local std::optional<llvm::orc::ThreadSafeContext::Lock> ReplLock;
+    
+    // The pass pipeline and analysis managers are built once and reused for
+    // every module, InitModuleAndManagers only drops their cached results.
+    static void InitPassManagers() {
         TheFPM = std::make_unique<llvm::FunctionPassManager>();
         TheLAM = std::make_unique<llvm::LoopAnalysisManager>();
         TheFAM = std::make_unique<llvm::FunctionAnalysisManager>();
         TheCGAM = std::make_unique<llvm::CGSCCAnalysisManager>();
         TheMAM = std::make_unique<llvm::ModuleAnalysisManager>();
         ThePIC = std::make_unique<llvm::PassInstrumentationCallbacks>();
-        TheSI = std::make_unique<llvm::StandardInstrumentations>(*TheContext,
+        TheSI = std::make_unique<llvm::StandardInstrumentations>(*ReplContext.getContext(),
                 /*DebugLogging*/ true);
         TheSI->registerCallbacks(*ThePIC, TheMAM.get());
         
         // Add transform passes.
-// Do simple "peephole" optimizations and bit-twiddling optzns.
-        TheFPM->addPass(llvm::InstCombinePass());
-// Reassociate expressions.
-        TheFPM->addPass(llvm::ReassociatePass());
-// Eliminate Common SubExpressions.
-        TheFPM->addPass(llvm::GVNPass());
-// Simplify the control flow graph (deleting unreachable blocks, etc.).
-        TheFPM->addPass(llvm::SimplifyCFGPass());// Register analysis passes used in these transform passes.
-
+        addFunctionPasses(*TheFPM);
+        // Register analysis passes used in these transform passes.
         llvm::PassBuilder PB;
         PB.registerModuleAnalyses(*TheMAM);
         PB.registerFunctionAnalyses(*TheFAM);
         PB.crossRegisterProxies(*TheLAM, *TheFAM, *TheCGAM, *TheMAM);
+    }
+    
+    // Open a new module (and builder) in TSC, which becomes the current context.
+    static void setContext(llvm::orc::ThreadSafeContext TSC) {
+        TheModule.reset();
+        Builder.reset();
+        TheTSContext = std::move(TSC);
+        TheContext = TheTSContext.getContext();
+        TheModule = std::make_unique<llvm::Module>("DustJIT", *TheContext);
+        TheModule->setDataLayout(TheJIT->getDataLayout());
+        Builder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
+    }
+    
+    void InitModuleAndManagers() {
+        if (!ReplContext.getContext()) {
+            ReplContext = llvm::orc::ThreadSafeContext(std::make_unique<llvm::LLVMContext>());
+            InitPassManagers();
+        }
+        // The cached analyses refer to the IR of the module just handed off.
+        TheFAM->clear();
+        TheLAM->clear();
+        TheCGAM->clear();
+        TheMAM->clear();
+        
+        if (!ReplLock)
+            ReplLock.emplace(ReplContext.getLock());
+        setContext(ReplContext);
+    }
+    
+    void UseOwnContext() {
+        // Definitions stay in the JIT and may compile in the background while
+        // the REPL goes on, so they get a context of their own.
+        setContext(llvm::orc::ThreadSafeContext(std::make_unique<llvm::LLVMContext>()));
+    }
+    
+    llvm::orc::ThreadSafeModule TakeModule() {
+        auto TSM = llvm::orc::ThreadSafeModule(std::move(TheModule), TheTSContext);
+        // Let the JIT lock the context to compile it.
+        ReplLock.reset();
+        return TSM;
+    }
+    
+    void ClearState() {
+        TheModule.reset();
+        Builder.reset();
+        // The JIT may still be compiling in ReplContext on its threads.
+        ReplLock.reset();
+        TheJIT.reset();
+        // The trampolines and clones into all this are gone along with the JIT.
+        interp::Clear();
+        ClearFunctionIR();
+        ClearProfiles();
+        code::ClearImports();
         
+        TheSI.reset();
+        ThePIC.reset();
+        TheFPM.reset();
+        TheMAM.reset();
+        TheCGAM.reset();
+        TheFAM.reset();
+        TheLAM.reset();
+        TheTSContext = {};
+        TheContext = nullptr;
+        ReplContext = {};
+        
+        NamedValues.clear();
+        FunctionProtos.clear();
+        GlobalVars.clear();
+        StructDecls.clear();
+        GenericFuncs.clear();
+        Generators.clear();
+        Definitions.clear();
+        Versions.clear();
+        CurGenerator = nullptr;
+        OpenGenerators.clear();
+        lexer::tokens.clear();
+        lexer::tokIndex = 0;
+    }
+    
+    void OptimizeModule(llvm::Module &M, llvm::OptimizationLevel Level) {
+        OptimizeModule(M, Level, *TheJIT);
+    }
+    
+    void OptimizeModule(llvm::Module &M, llvm::OptimizationLevel Level, DustJIT &JIT) {
+        // Tune for the JIT's target so unrolling and inlining use real costs.
+        std::unique_ptr<llvm::TargetMachine> TM;
+        if (auto TMOrErr = JIT.createTargetMachine())
+            TM = std::move(*TMOrErr);
+        else
+            llvm::consumeError(TMOrErr.takeError());
+        
+        llvm::LoopAnalysisManager LAM;
+        llvm::FunctionAnalysisManager FAM;
+        llvm::CGSCCAnalysisManager CGAM;
+        llvm::ModuleAnalysisManager MAM;
+        llvm::PassBuilder PB(TM.get());
+        // With a profile (--profile-use), move the code that never ran out of
+        // the hot fns so they stay dense. The default pipeline leaves it off.
+        if (M.getProfileSummary(false)) {
+            PB.registerOptimizerLastEPCallback([](llvm::ModulePassManager &MPM, llvm::OptimizationLevel) {
+                MPM.addPass(llvm::HotColdSplittingPass());
+            });
+        }
+        PB.registerModuleAnalyses(MAM);
+        PB.registerCGSCCAnalyses(CGAM);
+        PB.registerFunctionAnalyses(FAM);
+        PB.registerLoopAnalyses(LAM);
+        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+        
+        llvm::ModulePassManager MPM = Level == llvm::OptimizationLevel::O0
+                                      ? PB.buildO0DefaultPipeline(Level)
+                                      : PB.buildPerModuleDefaultPipeline(Level);
+        MPM.run(M, MAM);
+    }
+    
+    void LowerCoroutines() {
+        // CoroSplit is a CGSCC pass, TheFPM cannot run it. The module pipeline
+        // also inlines the split ramps into their for-in loops, where CoroElide
+        // can keep the frames on the stack.
+        if (std::ranges::any_of(*TheModule, [](llvm::Function &F) { return F.isPresplitCoroutine(); }))
+            OptimizeModule(*TheModule, llvm::OptimizationLevel::O2);
+    }
+    
+    llvm::Expected<llvm::orc::ThreadSafeModule> OptimizeJITModule(DustJIT &JIT, llvm::orc::ThreadSafeModule TSM,
+                                                                 const llvm::orc::MaterializationResponsibility &) {
+        // The same function passes TheFPM runs at codegen time otherwise.
+        TSM.withModuleDo([&JIT](llvm::Module &M) {
+            // The key covers the IR before optimization, which determines the
+            // result, so a hit skips the passes as well as codegen.
+            if (auto *Cache = JIT.getObjectCache(); Cache && Cache->tagModule(M, functionPipeline()))
+                return;
+            llvm::FunctionPassManager FPM;
+            addFunctionPasses(FPM);
+            llvm::LoopAnalysisManager LAM;
+            llvm::FunctionAnalysisManager FAM;
+            llvm::CGSCCAnalysisManager CGAM;
+            llvm::ModuleAnalysisManager MAM;
+            llvm::PassBuilder PB;
+            PB.registerModuleAnalyses(MAM);
+            PB.registerFunctionAnalyses(FAM);
+            PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+            for (auto &F: M) {
+                if (!F.isDeclaration())
+                    FPM.run(F, FAM);
+            }
+        });
+        return std::move(TSM);
     }
     
 }
\ No newline at end of file
@@ -5,12 +5,14 @@
 
 #include "parser/parser.h"
 #include "ast/func.h"
+#include "code/unit.h"
+#include <cmath>
 
 namespace dust::parser{
     using namespace minilog;
     using namespace ast;
     
-    std::map<lexer::TokenId, int> BinOpPrecedence{
+    const std::map<lexer::TokenId, int> BinOpPrecedence{
             {lexer::ADD_TK, 10},
             {lexer::SUB_TK, 10},
             {lexer::MUL_TK, 20},
@@ -21,11 +23,13 @@ namespace dust::parser{
             {lexer::GREATEEQ_TK,5},
             {lexer::EQ_TK,5},
             {lexer::NOTEQ_TK,5},
+            {lexer::AND_TK,4},
+            {lexer::OR_TK,3},
             {lexer::ASSIGN_TK,2},
         
     };
-    std::function<void()> PassToken;
-    std::function<lexer::Token()>GetToken;
+    thread_local std::function<void()> PassToken;
+    thread_local std::function<lexer::Token()>GetToken;
     
     void assertToken(lexer::TokenId expect){
         if(GetToken().tok!=expect){
@@ -42,7 +46,9 @@ namespace dust::parser{
                         return  lexer::tokens[ lexer::tokIndex];
                     }else{
                         std::string line;
-                        std::getline(std::cin,line);
+                        if(!std::getline(std::cin,line)){
+                            return lexer::Token{lexer::EOF_TK,""};
+                        }
                         lexer::tokens=lexer::lexLine(line);
                         lexer::tokIndex=0;
                         return  parser::GetToken();
@@ -77,16 +83,27 @@ namespace dust::parser{
     
     int getTokPrecedence() {
         if (isBinOperator(GetToken()))
-            return BinOpPrecedence[GetToken().tok];
+            return BinOpPrecedence.at(GetToken().tok);
         else return -1;
     }
     
     uexpr MainLoop() {
+        code::PrefetchImports();
         while (GetToken().tok != lexer::EOF_TK) {
+            // No JIT'd code runs between two items, replaced fn bodies can go.
+            TheJIT->reclaim();
             if (GetToken().tok == lexer::FN_TK) {
                 InterpretFuncDef();
             } else if (GetToken().tok == lexer::EXTERN_TK) {
                 InterpretExtern();
+            } else if (GetToken().tok == lexer::VAR_TK || GetToken().tok == lexer::CONST_TK) {
+                InterpretGlobalVar();
+            } else if (GetToken().tok == lexer::STRUCT_TK) {
+                InterpretStruct();
+            } else if (GetToken().tok == lexer::GEN_TK) {
+                InterpretGenDef();
+            } else if (GetToken().tok == lexer::IMPORT_TK) {
+                InterpretImport();
             } else {
                 InterpretTopLevelExpr();
             }
@@ -101,6 +118,18 @@ namespace dust::parser{
         return ret;
     }
     
+    std::string parseImport() {
+        PassToken();//pass import
+        if (GetToken().tok != lexer::STRLIT_TK) {
+            minilog::log_error("expect the file to import in quotes");
+            return "";
+        }
+        std::string File = GetToken().val;
+        PassToken();
+        PassToken();//pass ;
+        return File;
+    }
+    
     uexpr parseNumberExpr() {
         auto ret = std::make_unique<NumberExprAST>(std::stod(GetToken().val));
         PassToken();
@@ -150,17 +179,41 @@ namespace dust::parser{
         return v;
     }
     
+    // parse any .field accesses following an operand
+    uexpr parsePostfix(uexpr e) {
+        while (e && GetToken().tok == lexer::DOT_TK) {
+            PassToken();//pass .
+            assertToken(lexer::IDENT_TK);
+            std::string field = GetToken().val;
+            PassToken();//pass field name
+            e = std::make_unique<MemberExprAST>(std::move(e), field);
+        }
+        return e;
+    }
+    
+    // parse a type annotation: num, str, or the name of a struct
+    std::pair<lexer::TokenId, std::string> parseType() {
+        auto tk = GetToken();
+        PassToken();//pass type
+        return {tk.tok, tk.tok == lexer::IDENT_TK ? tk.val : ""};
+    }
+    
     uexpr parsePrimary() {
         if (GetToken().tok == lexer::IDENT_TK) {
-            return parseIdentifierExpr();
+            return parsePostfix(parseIdentifierExpr());
         } else if (GetToken().tok == lexer::NUMLIT_TK) {
             return parseNumberExpr();
         } else if (GetToken().tok == lexer::STRLIT_TK) {
             return parseStringExpr();
         } else if (GetToken().tok == lexer::LPAR_TK) {
-            return parseParenthesisExpr();
+            return parsePostfix(parseParenthesisExpr());
         }else if (GetToken().tok == lexer::IF_TK) {
             return parseIfExpr();
+        }else if (GetToken().tok == lexer::NOT_TK) {
+            PassToken();//pass !
+            auto operand=parsePrimary();
+            if(!operand)return nullptr;
+            return std::make_unique<NotExprAST>(std::move(operand));
         }
         return nullptr;
     }
@@ -228,10 +281,30 @@ namespace dust::parser{
         return std::make_unique<IfStmtAST>(std::move(Cond),std::move(Then),std::vector<std::unique_ptr<StmtAST>>());
        
     }
-    std::unique_ptr<ForStmtAST> parseForStmt(){
+    std::unique_ptr<ForInStmtAST> parseForInStmt(std::string varName){
+        PassToken();//pass in
+        assertToken(lexer::IDENT_TK);
+        auto Gen=parseIdentifierExpr();
+        auto *Call=dynamic_cast<CallExprAST*>(Gen.get());
+        if(!Call){
+            minilog::log_error("expect a generator call after in");
+            return nullptr;
+        }
+        assertToken(lexer::LBRACE_TK);
+        PassToken();//pass {
+        auto Body=parseCodeBlock();
+        PassToken();//pass }
+        minilog::log_info("parsed for-in statement");
+        return std::make_unique<ForInStmtAST>(std::move(varName),Call->getCallee(),
+                                              Call->takeArgs(),std::move(Body));
+    }
+    std::unique_ptr<StmtAST> parseForStmt(){
         PassToken();//pass for
         std::string varName=GetToken().val;
         PassToken();
+        if(GetToken().tok == lexer::IN_TK){
+            return parseForInStmt(varName);
+        }
         PassToken();//pass =
         auto InitVal=parseExpression();
         PassToken();//pass ;
@@ -248,6 +321,65 @@ namespace dust::parser{
         minilog::log_info("parsed for statement");
         return std::make_unique<ForStmtAST>(varName,std::move(InitVal),std::move(Cond),std::move(Then),std::move(Body));
     }
+    std::unique_ptr<YieldStmtAST> parseYieldStmt(){
+        PassToken();//pass yield
+        auto Val=parseExpression();
+        if(!Val)return nullptr;
+        assertToken(lexer::SEMICON_TK);
+        PassToken();//pass ;
+        return std::make_unique<YieldStmtAST>(std::move(Val));
+    }
+    std::unique_ptr<MatchStmtAST> parseMatchStmt(){
+        PassToken();//pass match
+        auto Val=parseExpression();
+        if(!Val)return nullptr;
+        assertToken(lexer::LBRACE_TK);
+        PassToken();//pass {
+        std::vector<MatchStmtAST::Case> Cases;
+        std::vector<std::unique_ptr<StmtAST>> Default;
+        while(GetToken().tok != lexer::RBRACE_TK){
+            if(GetToken().tok == lexer::ELSE_TK){
+                PassToken();//pass else
+                assertToken(lexer::ARROW_TK);
+                PassToken();//pass =>
+                assertToken(lexer::LBRACE_TK);
+                PassToken();//pass {
+                Default=parseCodeBlock();
+                PassToken();//pass }
+                continue;
+            }
+            MatchStmtAST::Case Case;
+            // labels are integer literals separated by ',', optionally negated
+            while(true){
+                bool negative=false;
+                if(GetToken().tok == lexer::SUB_TK){
+                    negative=true;
+                    PassToken();//pass -
+                }
+                assertToken(lexer::NUMLIT_TK);
+                double label=std::stod(GetToken().val);
+                // out of the i64 range the conversion below is undefined
+                if(label!=std::trunc(label)||label>=0x1p63){
+                    minilog::log_error("match label must be a 64-bit integer, get {}",GetToken().val);
+                    return nullptr;
+                }
+                PassToken();//pass label
+                Case.Labels.push_back(static_cast<int64_t>(negative?-label:label));
+                if(GetToken().tok != lexer::COMMA_TK)break;
+                PassToken();//pass ,
+            }
+            assertToken(lexer::ARROW_TK);
+            PassToken();//pass =>
+            assertToken(lexer::LBRACE_TK);
+            PassToken();//pass {
+            Case.Body=parseCodeBlock();
+            PassToken();//pass }
+            Cases.push_back(std::move(Case));
+        }
+        PassToken();//pass }
+        minilog::log_info("parsed match statement");
+        return std::make_unique<MatchStmtAST>(std::move(Val),std::move(Cases),std::move(Default));
+    }
     std::unique_ptr<VarStmtAST> parseVarStmt();
     std::unique_ptr<StmtAST> parseStatement(){
         if(GetToken().tok == lexer::RET_TK){
@@ -256,6 +388,10 @@ namespace dust::parser{
             return parseIfStmt();
         }else if(GetToken().tok == lexer::FOR_TK){
             return parseForStmt();
+        }else if(GetToken().tok == lexer::MATCH_TK){
+            return parseMatchStmt();
+        }else if(GetToken().tok == lexer::YIELD_TK){
+            return parseYieldStmt();
         }else if(GetToken().tok == lexer::VAR_TK){
             return parseVarStmt();
         }else if(GetToken().tok == lexer::SEMICON_TK){
@@ -275,15 +411,35 @@ namespace dust::parser{
         return stmts;
     }
     
+    // true if the next token starts a top-level statement rather than a definition
+    bool isTopLevelStmt(lexer::TokenId tok){
+        switch(tok){
+            case lexer::EOF_TK:
+            case lexer::FN_TK:
+            case lexer::EXTERN_TK:
+            case lexer::VAR_TK:
+            case lexer::CONST_TK:
+            case lexer::STRUCT_TK:
+            case lexer::GEN_TK:
+            case lexer::IMPORT_TK:
+                return false;
+            default:
+                return true;
+        }
+    }
+    
     std::unique_ptr<FunctionAST> parseTopLevelExpr() {
-        if (auto e = parseStatement()) {
-            auto proto = std::make_unique<PrototypeAST>("__anon_expr", std::vector<Variable>());
-            std::vector<std::unique_ptr<StmtAST>>stmt;
+        std::vector<std::unique_ptr<StmtAST>>stmt;
+        // Statements that follow directly, up to the next definition (or the end
+        // of the line in interactive mode), are compiled and run as one __anon_expr.
+        do{
+            auto e = parseStatement();
+            if (!e) return nullptr;
             stmt.emplace_back(std::move(e));
-            stmt.emplace_back(std::make_unique<ReturnStmtAST>(std::make_unique<NumberExprAST>(0)));
-            return std::make_unique<FunctionAST>(std::move(proto), std::move(stmt));
-        }
-        return nullptr;
+        }while(lexer::tokIndex < lexer::tokens.size() && isTopLevelStmt(GetToken().tok));
+        auto proto = std::make_unique<PrototypeAST>("__anon_expr", std::vector<Variable>());
+        stmt.emplace_back(std::make_unique<ReturnStmtAST>(std::make_unique<NumberExprAST>(0)));
+        return std::make_unique<FunctionAST>(std::move(proto), std::move(stmt));
     }
     
     std::unique_ptr<PrototypeAST> parseFuncDecl() {
@@ -296,11 +452,14 @@ namespace dust::parser{
         while (GetToken().tok != lexer::RPAR_TK) {
             const auto& name=GetToken().val;
             PassToken();//pass parameter name
-            assertToken(lexer::COLON_TK);
-            PassToken();//pass colon
-            const auto type=GetToken().tok;
-            PassToken();//pass type
-            args.emplace_back(name,type);
+            if (GetToken().tok == lexer::COLON_TK) {
+                PassToken();//pass colon
+                auto [type, typeName]=parseType();
+                args.push_back(Variable{name,type,typeName});
+            } else {
+                // no annotation, the fn is generic over this parameter
+                args.push_back(Variable{name,InferredType});
+            }
             if (GetToken().tok == lexer::RPAR_TK) {
                 break;
             }
@@ -309,14 +468,16 @@ namespace dust::parser{
         }
         assertToken(lexer::RPAR_TK);
         PassToken();//pass )
-        lexer::TokenId retType=lexer::NUM_TK;
+        std::string retTypeName;
+        // generic fns infer their return type unless it is given
+        lexer::TokenId retType=std::ranges::any_of(args,[](const Variable&v){return v.typeId==InferredType;})
+                ?InferredType:lexer::NUM_TK;
         if(GetToken().tok==lexer::COLON_TK){
             PassToken();//pass :
-            retType=GetToken().tok;
-            PassToken();//pass type
+            std::tie(retType, retTypeName)=parseType();
         }
 //        minilog::log_info("parsed func decl");
-        return std::make_unique<PrototypeAST>(fnName, args,retType);
+        return std::make_unique<PrototypeAST>(fnName, args,retType,retTypeName);
     }
     
     std::unique_ptr<FunctionAST> parseFuncDef() {
@@ -341,6 +502,14 @@ namespace dust::parser{
         return std::make_unique<FunctionAST>(std::move(signature), std::move(def));
     }
     
+    std::unique_ptr<GeneratorAST> parseGenDef() {
+        PassToken();//pass gen
+        assertToken(lexer::FN_TK);
+        auto def = parseFuncDef();
+        // the declared return type is the type of the yielded values
+        return std::make_unique<GeneratorAST>(std::make_unique<PrototypeAST>(def->getProto()), def->takeBody());
+    }
+    
     std::unique_ptr<ExprAST> parseIfExpr(){
         PassToken();//pass if
         auto Cond=parseExpression();
@@ -372,8 +541,7 @@ namespace dust::parser{
             PassToken();  // pass identifier.
             assertToken(lexer::COLON_TK);
             PassToken();//pass :
-            auto type= GetToken().tok;
-            PassToken();//pass type identifier
+            auto [type, typeName]= parseType();
             // Read the optional initializer.
             std::unique_ptr<ExprAST> Init;
             if (GetToken().tok == lexer::ASSIGN_TK) {
@@ -383,7 +551,7 @@ namespace dust::parser{
                 if (!Init) return nullptr;
             }
             
-            vars.emplace_back(Variable{Name, type}, std::move(Init));
+            vars.emplace_back(Variable{Name, type, typeName}, std::move(Init));
             
             // End of var list, exit loop.
             if (GetToken().tok != lexer::COMMA_TK) break;
@@ -406,5 +574,64 @@ namespace dust::parser{
                                             std::move(Body));
     }
     
+    std::vector<std::unique_ptr<GlobalVarAST>> parseGlobalVar(){
+        bool isConst = GetToken().tok == lexer::CONST_TK;
+        PassToken();//pass var or const
+        std::vector<std::unique_ptr<GlobalVarAST>> globals;
+        while (true) {
+            if (GetToken().tok != lexer::IDENT_TK){
+                minilog::log_error("expect identifier");
+                return {};
+            }
+            std::string Name = GetToken().val;
+            PassToken();  // pass identifier.
+            assertToken(lexer::COLON_TK);
+            PassToken();//pass :
+            auto [type, typeName]= parseType();
+            std::unique_ptr<ExprAST> Init;
+            if (GetToken().tok == lexer::ASSIGN_TK) {
+                PassToken(); // eat the '='.
+                Init = parseExpression();
+                if (!Init) return {};
+            } else if (isConst) {
+                minilog::log_error("constant {} needs an initializer", Name);
+                return {};
+            }
+            globals.push_back(std::make_unique<GlobalVarAST>(Variable{Name, type, typeName}, isConst, std::move(Init)));
+            
+            if (GetToken().tok != lexer::COMMA_TK) break;
+            PassToken(); // eat the ','.
+        }
+        assertToken(lexer::SEMICON_TK);
+        PassToken();  // eat ';'.
+        return globals;
+    }
+    
+    std::unique_ptr<StructAST> parseStructDef(){
+        PassToken();//pass struct
+        assertToken(lexer::IDENT_TK);
+        std::string Name = GetToken().val;
+        PassToken();//pass struct name
+        assertToken(lexer::LBRACE_TK);
+        PassToken();//pass {
+        std::vector<Variable> fields;
+        while (GetToken().tok != lexer::RBRACE_TK) {
+            assertToken(lexer::IDENT_TK);
+            std::string field = GetToken().val;
+            PassToken();//pass field name
+            assertToken(lexer::COLON_TK);
+            PassToken();//pass :
+            auto [type, typeName] = parseType();
+            fields.push_back(Variable{field, type, typeName});
+            if (GetToken().tok == lexer::RBRACE_TK) {
+                break;
+            }
+            assertToken(lexer::COMMA_TK);
+            PassToken();//pass ,
+        }
+        PassToken();//pass }
+        return std::make_unique<StructAST>(Name, std::move(fields));
+    }
+    
     
 }
\ No newline at end of file
@@ -0,0 +1,181 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "parser/parser.h"
+#include "utils/options.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/ProfileData/InstrProf.h"
+#include "llvm/ProfileData/ProfileCommon.h"
+#include <fstream>
+#include <sstream>
+
+namespace dust::parser{
+    // Counts of one fn: the number of entries, then for each conditional branch
+    // in block order how often it ran and how often it took the true edge.
+    using Counts = std::vector<uint64_t>;
+
+    // Written to by the instrumented code, so the vectors never move once the
+    // code has their address. A fn compiled again (tier 1) shares the counts.
+    static thread_local std::map<std::string, std::unique_ptr<Counts>> Generated;
+    // Counts of earlier bodies with other branches, the code still linked in
+    // (a running call, inlined generic instances) goes on writing to them.
+    // Freed with the JIT, not written out.
+    static thread_local std::vector<std::unique_ptr<Counts>> Replaced;
+
+    // Loaded with --profile-use.
+    static thread_local std::map<std::string, Counts> Loaded;
+    static thread_local std::unique_ptr<llvm::ProfileSummary> Summary;
+
+    static std::vector<llvm::BranchInst *> condBranches(llvm::Function &F) {
+        std::vector<llvm::BranchInst *> Branches;
+        for (auto &BB: F) {
+            if (auto *Br = llvm::dyn_cast<llvm::BranchInst>(BB.getTerminator()); Br && Br->isConditional())
+                Branches.push_back(Br);
+        }
+        return Branches;
+    }
+
+    // Counters of a fn compiled ahead of time, named after it.
+    static constexpr llvm::StringLiteral CountersPrefix = "__dust_prof.";
+
+    static void instrument(llvm::Function &F) {
+        auto Branches = condBranches(F);
+        size_t Size = 1 + 2 * Branches.size();
+        llvm::IRBuilder<> B(&*F.getEntryBlock().getFirstInsertionPt());
+        auto *I64 = B.getInt64Ty();
+        llvm::Value *Base;
+        if (Opts.Output == Options::OutputKind::JIT) {
+            auto &C = Generated[F.getName().str()];
+            if (C && C->size() != Size)
+                Replaced.push_back(std::move(C));
+            if (!C)
+                C = std::make_unique<Counts>(Size);
+            // The counters live in this process, the JIT'd code adds to them in place.
+            Base = B.CreateIntToPtr(B.getInt64(reinterpret_cast<uint64_t>(C->data())),
+                                    llvm::PointerType::getUnqual(*TheContext));
+        } else {
+            // In the program, which writes them out on exit (see EmitProfileRegistration).
+            auto *Ty = llvm::ArrayType::get(I64, Size);
+            Base = new llvm::GlobalVariable(*F.getParent(), Ty, false, llvm::GlobalValue::InternalLinkage,
+                                            llvm::ConstantAggregateZero::get(Ty), CountersPrefix + F.getName());
+        }
+        auto Add = [&](uint64_t Index, llvm::Value *N) {
+            llvm::Value *Ptr = B.CreateConstInBoundsGEP1_64(I64, Base, Index);
+            B.CreateStore(B.CreateAdd(B.CreateLoad(I64, Ptr), N), Ptr);
+        };
+        Add(0, B.getInt64(1));
+        for (size_t i = 0; i < Branches.size(); ++i) {
+            B.SetInsertPoint(Branches[i]);
+            Add(1 + 2 * i, B.getInt64(1));
+            Add(2 + 2 * i, B.CreateZExt(Branches[i]->getCondition(), I64));
+        }
+    }
+
+    static void annotate(llvm::Function &F) {
+        auto It = Loaded.find(F.getName().str());
+        if (It == Loaded.end())
+            return;
+        auto &C = It->second;
+        auto Branches = condBranches(F);
+        if (C.size() != 1 + 2 * Branches.size()) {
+            minilog::log_error("profile of {} does not match its code, ignored", F.getName().str());
+            return;
+        }
+        F.setEntryCount(llvm::Function::ProfileCount(C[0], llvm::Function::PCT_Real));
+        llvm::MDBuilder MDB(F.getContext());
+        for (size_t i = 0; i < Branches.size(); ++i) {
+            uint64_t Taken = C[2 + 2 * i], NotTaken = C[1 + 2 * i] - Taken;
+            // Weights are 32 bit, scale down keeping the ratio, and never zero
+            // like clang, so a branch that was not seen is unlikely but possible.
+            uint64_t Scale = std::max<uint64_t>(Taken, NotTaken) / UINT32_MAX + 1;
+            Branches[i]->setMetadata(llvm::LLVMContext::MD_prof, MDB.createBranchWeights(
+                    static_cast<uint32_t>(Taken / Scale + 1), static_cast<uint32_t>(NotTaken / Scale + 1)));
+        }
+        // Without a summary the optimizer does not know what counts as hot.
+        llvm::Module &M = *F.getParent();
+        if (!M.getProfileSummary(false))
+            M.setProfileSummary(Summary->getMD(F.getContext()), llvm::ProfileSummary::PSK_Instr);
+    }
+
+    void ProfileFunction(llvm::Function &F) {
+        if (!Opts.ProfileGenerate.empty())
+            instrument(F);
+        else if (!Opts.ProfileUse.empty())
+            annotate(F);
+    }
+
+    void EmitProfileRegistration() {
+        auto *PtrTy = llvm::PointerType::getUnqual(*TheContext);
+        auto *I64 = Builder->getInt64Ty();
+        // In lib/print.cc.
+        llvm::FunctionCallee Register = TheModule->getOrInsertFunction(
+                "dust_profile_register", llvm::FunctionType::get(Builder->getVoidTy(), {PtrTy, PtrTy, PtrTy, I64}, false));
+        llvm::Value *Path = Builder->CreateGlobalStringPtr(Opts.ProfileGenerate);
+        for (auto &G: TheModule->globals()) {
+            llvm::StringRef Name = G.getName();
+            if (!Name.consume_front(CountersPrefix))
+                continue;
+            uint64_t Size = llvm::cast<llvm::ArrayType>(G.getValueType())->getNumElements();
+            Builder->CreateCall(Register, {Path, Builder->CreateGlobalStringPtr(Name), &G, Builder->getInt64(Size)});
+        }
+    }
+
+    // One line per fn: fn <name> <entries> <branches>, then one line per branch:
+    // <executed> <taken>. lib/print.cc writes the same for compiled programs.
+    void WriteProfile(const std::string &Path) {
+        std::ofstream Out(Path);
+        for (const auto &[Name, C]: Generated) {
+            Out << "fn " << Name << " " << (*C)[0] << " " << (C->size() - 1) / 2 << "\n";
+            for (size_t i = 1; i < C->size(); i += 2)
+                Out << (*C)[i] << " " << (*C)[i + 1] << "\n";
+        }
+        if (!Out)
+            minilog::log_error("can not write profile {}", Path);
+    }
+
+    bool LoadProfile(const std::string &Path) {
+        std::ifstream In(Path);
+        if (!In) {
+            minilog::log_error("can not read profile {}", Path);
+            return false;
+        }
+        llvm::InstrProfSummaryBuilder Builder(llvm::ProfileSummaryBuilder::DefaultCutoffs);
+        std::string Line;
+        while (std::getline(In, Line)) {
+            std::istringstream S(Line);
+            std::string Tag, Name;
+            uint64_t Entries = 0;
+            size_t NumBranches = 0;
+            if (!(S >> Tag >> Name >> Entries >> NumBranches) || Tag != "fn") {
+                minilog::log_error("malformed profile {}: {}", Path, Line);
+                return false;
+            }
+            Counts C{Entries};
+            // The entry count, then the count of every edge.
+            std::vector<uint64_t> Record{Entries};
+            for (size_t i = 0; i < NumBranches; ++i) {
+                uint64_t Executed = 0, Taken = 0;
+                if (!(In >> Executed >> Taken) || Taken > Executed) {
+                    minilog::log_error("malformed profile {} in {}", Path, Name);
+                    return false;
+                }
+                C.push_back(Executed);
+                C.push_back(Taken);
+                Record.push_back(Taken);
+                Record.push_back(Executed - Taken);
+            }
+            Builder.addRecord(llvm::InstrProfRecord(std::move(Record)));
+            In >> std::ws;
+            Loaded[Name] = std::move(C);
+        }
+        Summary = Builder.getSummary();
+        return true;
+    }
+
+    void ClearProfiles() {
+        Generated.clear();
+        Replaced.clear();
+        Loaded.clear();
+        Summary.reset();
+    }
+}
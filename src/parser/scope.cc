@@ -0,0 +1,41 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "parser/scope.h"
+
+namespace dust::parser{
+
+    void ScopedSymbolTable::pushScope() {
+        Scopes.push_back(Entries.size());
+    }
+
+    void ScopedSymbolTable::popScope() {
+        size_t Mark = Scopes.back();
+        Scopes.pop_back();
+        while (Entries.size() > Mark) {
+            // Make the shadowed binding (or nothing, -1) visible again.
+            auto &E = Entries.back();
+            E.Slot->second = E.Shadowed;
+            Entries.pop_back();
+        }
+    }
+
+    void ScopedSymbolTable::declare(llvm::StringRef Name, Binding B) {
+        auto *Slot = &*Innermost.try_emplace(Name, -1).first;
+        Entries.push_back({Slot, B, Slot->second});
+        Slot->second = static_cast<int>(Entries.size() - 1);
+    }
+
+    const Binding *ScopedSymbolTable::lookup(llvm::StringRef Name) const {
+        auto It = Innermost.find(Name);
+        if (It == Innermost.end() || It->second < 0)
+            return nullptr;
+        return &Entries[It->second].Bind;
+    }
+
+    void ScopedSymbolTable::clear() {
+        Innermost.clear();
+        Entries.clear();
+        Scopes.clear();
+    }
+}
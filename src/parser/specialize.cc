@@ -0,0 +1,153 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "parser/parser.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <format>
+
+namespace dust::parser{
+    // Bitcode of each function's module as it was handed to the JIT, so the
+    // function can be cloned again later.
+    static thread_local llvm::StringMap<llvm::SmallVector<char, 0>> FunctionIR;
+    // How often each function was recorded, a redefinition gets new clone names.
+    static thread_local llvm::StringMap<unsigned> Recordings;
+
+    // Clones already in the JIT, by callee and argument values.
+    static thread_local std::map<std::pair<std::string, std::vector<double>>, std::string> Specializations;
+
+    llvm::SmallVector<char, 0> ModuleBitcode() {
+        llvm::SmallVector<char, 0> Buf;
+        llvm::raw_svector_ostream OS(Buf);
+        llvm::WriteBitcodeToFile(*TheModule, OS);
+        return Buf;
+    }
+
+    void RecordFunctionIR(const std::string &Name, llvm::SmallVector<char, 0> Bitcode) {
+        // Clones of an earlier definition are stale.
+        std::erase_if(Specializations, [&](const auto &S) { return S.first.first == Name; });
+        ++Recordings[Name];
+        FunctionIR[Name] = std::move(Bitcode);
+    }
+
+    void ClearFunctionIR() {
+        FunctionIR.clear();
+        Recordings.clear();
+        Specializations.clear();
+    }
+
+    llvm::StringRef GetFunctionIR(const std::string &Name) {
+        auto It = FunctionIR.find(Name);
+        if (It == FunctionIR.end())
+            return "";
+        return {It->second.data(), It->second.size()};
+    }
+    
+    void ImportCallees(llvm::Module &M) {
+        std::vector<std::string> Callees;
+        for (auto &F: M) {
+            if (F.isDeclaration() && FunctionIR.contains(F.getName()))
+                Callees.push_back(F.getName().str());
+        }
+        for (const auto &Callee: Callees) {
+            auto &Buf = FunctionIR[Callee];
+            auto Src = llvm::parseBitcodeFile(
+                    llvm::MemoryBufferRef(llvm::StringRef(Buf.data(), Buf.size()), Callee), M.getContext());
+            if (!Src) {
+                llvm::consumeError(Src.takeError());
+                continue;
+            }
+            llvm::Function *F = (*Src)->getFunction(Callee);
+            if (!F || F->isDeclaration())
+                continue;
+            // Only a copy for the inliner, the calls left still go to the stub.
+            F->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+            if (llvm::Linker::linkModules(M, std::move(*Src), llvm::Linker::LinkOnlyNeeded))
+                minilog::log_error("can not import {} for inlining", Callee);
+        }
+    }
+    
+    // Match a top-level statement of the form f(1, 2.5); where f has recorded IR.
+    static std::optional<std::pair<std::string, std::vector<double>>> matchConstantCall(FunctionAST &TopLevel) {
+        // A batch of statements, or the call and the trailing return 0.
+        if (TopLevel.getBody().size() != 2)
+            return std::nullopt;
+        auto *Stmt = dynamic_cast<RegularStmtAST *>(TopLevel.getBody().front().get());
+        if (!Stmt)
+            return std::nullopt;
+        auto *Call = dynamic_cast<CallExprAST *>(Stmt->val.get());
+        if (!Call || !FunctionIR.contains(Call->getCallee()))
+            return std::nullopt;
+        std::vector<double> Vals;
+        for (const auto &Arg: Call->getArgs()) {
+            auto *Num = dynamic_cast<NumberExprAST *>(Arg.get());
+            if (!Num)
+                return std::nullopt;
+            Vals.push_back(Num->getVal());
+        }
+        return std::make_pair(Call->getCallee(), std::move(Vals));
+    }
+
+    // Clone Callee with its parameters replaced by Vals, optimize the clone at O3
+    // and add it to the JIT. Returns the clone's name, or "" if Callee does not qualify.
+    static std::string specialize(const std::string &Callee, const std::vector<double> &Vals) {
+        auto Ctx = std::make_unique<llvm::LLVMContext>();
+        auto &Buf = FunctionIR[Callee];
+        auto M = llvm::parseBitcodeFile(llvm::MemoryBufferRef(llvm::StringRef(Buf.data(), Buf.size()), Callee), *Ctx);
+        if (!M) {
+            minilog::log_error("can not read the IR of {}: {}", Callee, llvm::toString(M.takeError()));
+            return "";
+        }
+
+        llvm::Function *F = (*M)->getFunction(Callee);
+        // Only num parameters can take the literals, and the clone is called as a
+        // plain function without arguments, so it must return in registers.
+        if (!F || F->arg_size() != Vals.size() || F->getReturnType()->isStructTy() ||
+            !std::ranges::all_of(F->args(), [](llvm::Argument &A) { return A.getType()->isDoubleTy(); }))
+            return "";
+
+        std::string Name = Callee + "(";
+        llvm::ValueToValueMapTy VMap;
+        for (size_t i = 0; i < Vals.size(); ++i) {
+            VMap[F->getArg(i)] = llvm::ConstantFP::get(F->getArg(i)->getType(), Vals[i]);
+            Name += std::format("{}{}", i ? "," : "", Vals[i]);
+        }
+        Name += ")";
+        if (unsigned N = Recordings[Callee]; N > 1)
+            Name += std::format("#{}", N);
+        llvm::Function *Clone = llvm::CloneFunction(F, VMap);
+        Clone->setName(Name);
+        // The original stays in the JIT, recursive calls resolve to it.
+        F->deleteBody();
+
+        // With the arguments known, loops get constant trip counts and unroll,
+        // and tests on the arguments fold away.
+        OptimizeModule(**M, llvm::OptimizationLevel::O3);
+        if (JITFailed(TheJIT->addModule(llvm::orc::ThreadSafeModule(std::move(*M), std::move(Ctx))), Name))
+            return "";
+        return Name;
+    }
+
+    bool RunSpecialized(FunctionAST &TopLevel) {
+        auto Call = matchConstantCall(TopLevel);
+        if (!Call)
+            return false;
+
+        auto It = Specializations.find(*Call);
+        if (It == Specializations.end()) {
+            std::string Name = specialize(Call->first, Call->second);
+            if (Name.empty())
+                return false;
+            It = Specializations.emplace(*Call, Name).first;
+        }
+
+        // Done either way, a failure is reported like that of any expression.
+        auto Sym = TheJIT->lookup(It->second);
+        if (!JITFailed(Sym.takeError(), It->second))
+            RunJITCode(Sym->getAddress());
+        return true;
+    }
+}
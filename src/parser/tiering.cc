@@ -0,0 +1,88 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "parser/parser.h"
+#include "utils/options.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+namespace dust::parser{
+    // Called by tier 0 code once its counter reaches the threshold.
+    static constexpr llvm::StringLiteral TierUpFn = "__dust_tier_up";
+
+    // Runs on the thread executing the hot body, Impl is its name (fn$N). The
+    // bitcode is copied here, the recompile itself goes to the JIT's threads
+    // and the caller goes on in tier 0.
+    static void tierUp(const char *Impl) {
+        std::string Body = Impl;
+        std::string Fn = Body.substr(0, Body.find('$'));
+        std::string Bitcode = GetFunctionIR(Fn).str();
+        if (Bitcode.empty())
+            return;
+        // The pool's threads have no TheJIT, the task takes this thread's.
+        DustJIT *JIT = TheJIT.get();
+        JIT->dispatch([JIT, Fn, Body, Bitcode = std::move(Bitcode)] {
+            auto Ctx = std::make_unique<llvm::LLVMContext>();
+            // A recompile that fails leaves tier 0 in place.
+            auto M = llvm::parseBitcodeFile(llvm::MemoryBufferRef(Bitcode, Fn), *Ctx);
+            if (!M) {
+                JIT->reportError(M.takeError());
+                return;
+            }
+            // Recursive calls now go straight to the optimized code, not the stub.
+            (*M)->getFunction(Fn)->setName(Body + "$t1");
+            OptimizeModule(**M, llvm::OptimizationLevel::O3, *JIT);
+            // Dropped if Fn was redefined in the meantime. Tier 0 is retired and
+            // freed once it is no longer running.
+            auto Swapped = JIT->defineFunction(Fn, Body + "$t1",
+                                               llvm::orc::ThreadSafeModule(std::move(*M), std::move(Ctx)), Body);
+            if (!Swapped)
+                JIT->reportError(Swapped.takeError());
+        }, "tier up");
+    }
+
+    // Count one more call or loop iteration before I, and call tierUp on the
+    // count that reaches the threshold. Not atomic, a lost count in a race
+    // only delays the tier-up.
+    static void addCounter(llvm::Instruction *I, llvm::GlobalVariable *Hits, llvm::Constant *Name,
+                           llvm::FunctionCallee TierUp) {
+        llvm::IRBuilder<> B(I);
+        llvm::Value *N = B.CreateAdd(B.CreateLoad(B.getInt64Ty(), Hits), B.getInt64(1));
+        B.CreateStore(N, Hits);
+        llvm::Value *Hot = B.CreateICmpEQ(N, B.getInt64(Opts.TierThreshold));
+        B.SetInsertPoint(llvm::SplitBlockAndInsertIfThen(Hot, I, false));
+        B.CreateCall(TierUp, {Name});
+    }
+
+    void InstrumentTier0(llvm::Function &F) {
+        if (!TheJIT->hasHostFunction(TierUpFn))
+            ExitOnErr(TheJIT->addHostFunction(TierUpFn, llvm::orc::ExecutorAddr::fromPtr(&tierUp)));
+
+        std::string Name = F.getName().str();
+        auto *Hits = new llvm::GlobalVariable(*TheModule, Builder->getInt64Ty(), false,
+                                              llvm::GlobalValue::InternalLinkage, Builder->getInt64(0),
+                                              Name + "$hits");
+        llvm::Constant *NameStr = Builder->CreateGlobalString(Name, Name + "$name", 0, TheModule.get());
+        auto *PtrTy = llvm::PointerType::getUnqual(*TheContext);
+        llvm::FunctionCallee TierUp = TheModule->getOrInsertFunction(
+                TierUpFn, llvm::FunctionType::get(Builder->getVoidTy(), {PtrTy}, false));
+
+        // Entry, after the allocas, and every back-edge: the end of a block
+        // branching to a block that dominates it.
+        std::vector<llvm::Instruction *> Points;
+        auto It = F.getEntryBlock().begin();
+        while (llvm::isa<llvm::AllocaInst>(*It))
+            ++It;
+        Points.push_back(&*It);
+        llvm::DominatorTree DT(F);
+        for (auto &BB: F) {
+            if (llvm::any_of(llvm::successors(&BB), [&](llvm::BasicBlock *S) { return DT.dominates(S, &BB); }))
+                Points.push_back(BB.getTerminator());
+        }
+        for (auto *I: Points)
+            addCounter(I, Hits, NameStr, TierUp);
+    }
+}
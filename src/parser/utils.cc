@@ -30,6 +30,19 @@ namespace dust::parser{
         return nullptr;
     }
     
+    llvm::GlobalVariable *getGlobal(const std::string &Name) {
+        // Globals are referenced the same way as functions: reuse the declaration
+        // already in this module, or emit one from the recorded definition.
+        if (auto *GV = TheModule->getNamedGlobal(Name))
+            return GV;
+        
+        auto GI = GlobalVars.find(Name);
+        if (GI != GlobalVars.end())
+            return GI->second->codegenDecl();
+        
+        return nullptr;
+    }
+    
     llvm::Type* getType(lexer::TokenId t){
         if(t==lexer::NUM_TK){
             return llvm::Type::getDoubleTy(*TheContext);
@@ -41,4 +54,56 @@ namespace dust::parser{
         }
     }
     
+    llvm::Type* getType(lexer::TokenId t, const std::string &typeName){
+        if(t!=lexer::IDENT_TK){
+            return getType(t);
+        }
+        auto SI = StructDecls.find(typeName);
+        if(SI==StructDecls.end()){
+            minilog::log_error("Unknown type: {}", typeName);
+            std::exit(10);
+        }
+        return SI->second->codegen();
+    }
+    
+    llvm::Type* getType(const Variable &v){
+        return getType(v.typeId, v.typeName);
+    }
+    
+    std::optional<Variable> getDustType(llvm::Type *T){
+        if(T->isDoubleTy()){
+            return Variable{"", lexer::NUM_TK};
+        }else if(T->isPointerTy()){
+            return Variable{"", lexer::STR_TK};
+        }else if(auto *ST = llvm::dyn_cast<llvm::StructType>(T); ST && ST->hasName()){
+            return Variable{"", lexer::IDENT_TK, ST->getName().str()};
+        }
+        return std::nullopt;
+    }
+    
+    std::string getTypeName(const Variable &v){
+        switch (v.typeId) {
+            case lexer::NUM_TK:
+                return "num";
+            case lexer::STR_TK:
+                return "str";
+            case lexer::IDENT_TK:
+                return v.typeName;
+            default:
+                return "?";
+        }
+    }
+    
+    int getFieldIndex(llvm::Type *T, const std::string &Field) {
+        auto *ST = llvm::dyn_cast<llvm::StructType>(T);
+        if (!ST || !ST->hasName() || !StructDecls.contains(ST->getName().str())) {
+            minilog::log_error("member access on a value that is not a struct: {}", Field);
+            return -1;
+        }
+        int Idx = StructDecls[ST->getName().str()]->getFieldIndex(Field);
+        if (Idx < 0)
+            minilog::log_error("{} has no field {}", ST->getName().str(), Field);
+        return Idx;
+    }
+    
 } // namespace parser
\ No newline at end of file
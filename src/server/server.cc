@@ -0,0 +1,276 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "server/server.h"
+#include "code/gen.h"
+#include "code/snapshot.h"
+#include "code/unit.h"
+#include "parser/parser.h"
+#include "utils/options.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SHA1.h"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <sstream>
+
+#ifdef LLVM_ON_UNIX
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace dust::server{
+#ifndef LLVM_ON_UNIX
+    int Serve(const std::string &) {
+        minilog::log_error("--serve needs fork and Unix sockets");
+        return 1;
+    }
+
+    int RunClient(const std::string &, const std::string &) {
+        minilog::log_error("--client needs Unix sockets");
+        return 1;
+    }
+#else
+    struct Header {
+        uint32_t NameSize;
+        uint32_t SourceSize;
+    };
+
+    static bool writeAll(int FD, const void *Data, size_t Size) {
+        auto *P = static_cast<const char *>(Data);
+        while (Size) {
+            ssize_t N = write(FD, P, Size);
+            if (N <= 0)
+                return false;
+            P += N;
+            Size -= N;
+        }
+        return true;
+    }
+
+    static bool readAll(int FD, void *Data, size_t Size) {
+        auto *P = static_cast<char *>(Data);
+        while (Size) {
+            ssize_t N = read(FD, P, Size);
+            if (N <= 0)
+                return false;
+            P += N;
+            Size -= N;
+        }
+        return true;
+    }
+
+    static bool socketAddress(const std::string &Socket, sockaddr_un &Addr) {
+        Addr = {};
+        Addr.sun_family = AF_UNIX;
+        if (Socket.size() >= sizeof(Addr.sun_path)) {
+            minilog::log_error("socket path {} is too long", Socket);
+            return false;
+        }
+        Socket.copy(Addr.sun_path, Socket.size());
+        return true;
+    }
+
+    // The header along with three fds, the sender's stdin, stdout and stderr.
+    static bool sendHeader(int Conn, const Header &H) {
+        iovec IO{const_cast<Header *>(&H), sizeof(H)};
+        alignas(cmsghdr) char Control[CMSG_SPACE(3 * sizeof(int))] = {};
+        msghdr Msg{};
+        Msg.msg_iov = &IO;
+        Msg.msg_iovlen = 1;
+        Msg.msg_control = Control;
+        Msg.msg_controllen = sizeof(Control);
+        cmsghdr *C = CMSG_FIRSTHDR(&Msg);
+        C->cmsg_level = SOL_SOCKET;
+        C->cmsg_type = SCM_RIGHTS;
+        C->cmsg_len = CMSG_LEN(3 * sizeof(int));
+        int FDs[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+        memcpy(CMSG_DATA(C), FDs, sizeof(FDs));
+        return sendmsg(Conn, &Msg, 0) == static_cast<ssize_t>(sizeof(H));
+    }
+
+    static bool receiveHeader(int Conn, Header &H, int (&FDs)[3]) {
+        iovec IO{&H, sizeof(H)};
+        alignas(cmsghdr) char Control[CMSG_SPACE(3 * sizeof(int))] = {};
+        msghdr Msg{};
+        Msg.msg_iov = &IO;
+        Msg.msg_iovlen = 1;
+        Msg.msg_control = Control;
+        Msg.msg_controllen = sizeof(Control);
+        if (recvmsg(Conn, &Msg, MSG_WAITALL) != static_cast<ssize_t>(sizeof(H)))
+            return false;
+        cmsghdr *C = CMSG_FIRSTHDR(&Msg);
+        if (!C || C->cmsg_type != SCM_RIGHTS || C->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+            return false;
+        memcpy(FDs, CMSG_DATA(C), sizeof(FDs));
+        return true;
+    }
+
+    // Compile Source into an image at Path, in a child so the state of this
+    // process stays as it is for running the image.
+    static bool compileImage(const std::string &Source, const std::string &Path) {
+        pid_t Pid = fork();
+        if (Pid == 0) {
+            std::string Tmp = std::format("{}.{}", Path, getpid());
+            Opts.Output = Options::OutputKind::Snapshot;
+            Opts.OutputPath = Tmp;
+            lexer::tokens = lexer::lexLine(Source);
+            lexer::tokIndex = 0;
+            parser::SetParseMode(parser::File);
+            int Status = code::CompileProgram();
+            // Another request for the same source may be writing it too.
+            if (Status == 0 && std::rename(Tmp.c_str(), Path.c_str()) != 0)
+                Status = 1;
+            fflush(nullptr);
+            _exit(Status);
+        }
+        int Status = 0;
+        return Pid > 0 && waitpid(Pid, &Status, 0) == Pid && WIFEXITED(Status) && WEXITSTATUS(Status) == 0;
+    }
+
+    // What an image depends on besides its script: the image format, the
+    // target, the dust binary compiling it and the --load prelude it is
+    // compiled against.
+    static std::string imageSalt() {
+        llvm::SHA1 Hash;
+        Hash.update(std::format("{} {} {}\n", code::ImageVersion, parser::TheJIT->getTargetId(), code::CompilerId()));
+        if (!Opts.LoadImage.empty()) {
+            if (auto Prelude = llvm::MemoryBuffer::getFile(Opts.LoadImage))
+                Hash.update((*Prelude)->getBuffer());
+        }
+        return llvm::toHex(Hash.final(), /*LowerCase*/ true);
+    }
+
+    // In the child forked for the request on Conn.
+    static int handle(int Conn, const std::string &Images, const std::string &Salt) {
+        Header H{};
+        int FDs[3];
+        if (!receiveHeader(Conn, H, FDs))
+            return 1;
+        std::string Name(H.NameSize, '\0'), Source(H.SourceSize, '\0');
+        if (!readAll(Conn, Name.data(), Name.size()) || !readAll(Conn, Source.data(), Source.size()))
+            return 1;
+        dup2(FDs[0], STDIN_FILENO);
+        dup2(FDs[1], STDOUT_FILENO);
+        dup2(FDs[2], STDERR_FILENO);
+        for (int FD: FDs)
+            close(FD);
+        Opts.Source = Name;
+
+        // The name too, imports are resolved from it. The images of the
+        // imported units are named after all they depend on, the script's
+        // image is stale once one of them changes.
+        llvm::SHA1 Hash;
+        Hash.update(Salt);
+        Hash.update(Name);
+        Hash.update(llvm::StringRef("\0", 1));
+        Hash.update(Source);
+        for (const auto &Unit: code::ImportedImages(Source, Name)) {
+            Hash.update(llvm::StringRef("\0", 1));
+            Hash.update(Unit);
+        }
+        std::string Image = (fs::path(Images) / (llvm::toHex(Hash.final(), /*LowerCase*/ true) + ".img")).string();
+        int32_t Status = 1;
+        if (fs::exists(Image) || compileImage(Source, Image))
+            Status = code::LoadSnapshot(Image) ? 0 : 1;
+        fflush(nullptr);
+        writeAll(Conn, &Status, sizeof(Status));
+        return 0;
+    }
+
+    int Serve(const std::string &Socket) {
+        // Images are only valid for this JIT, keep them apart from --cache-dir objects.
+        std::string Images = (Opts.CacheDir.empty() ? Socket + ".images" : Opts.CacheDir + "/images");
+        std::error_code EC;
+        fs::create_directories(Images, EC);
+        if (EC) {
+            minilog::log_error("can not create {}: {}", Images, EC.message());
+            return 1;
+        }
+        sockaddr_un Addr;
+        if (!socketAddress(Socket, Addr))
+            return 1;
+        // Only a socket left behind by an earlier server is replaced.
+        struct stat Existing;
+        if (lstat(Socket.c_str(), &Existing) == 0) {
+            if (!S_ISSOCK(Existing.st_mode)) {
+                minilog::log_error("{} exists and is not a socket", Socket);
+                return 1;
+            }
+            unlink(Socket.c_str());
+        }
+        int Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        // Whoever can connect runs code as this user, the socket is ours alone.
+        mode_t Mask = umask(0077);
+        bool Bound = Listener >= 0 && bind(Listener, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) == 0;
+        umask(Mask);
+        if (!Bound || listen(Listener, SOMAXCONN) != 0) {
+            minilog::log_error("can not listen on {}: {}", Socket, strerror(errno));
+            return 1;
+        }
+        std::string Salt = imageSalt();
+        // The children are not waited for, they report to their client.
+        signal(SIGCHLD, SIG_IGN);
+        fprintf(stderr, "serving on %s\n", Socket.c_str());
+        while (true) {
+            int Conn = accept(Listener, nullptr, nullptr);
+            if (Conn < 0) {
+                if (errno == EINTR)
+                    continue;
+                minilog::log_error("accept failed: {}", strerror(errno));
+                return 1;
+            }
+            // The JIT of the server runs its tasks in place (see Engine::Create), this
+            // thread is the only one. The child gets the warm JIT as it is.
+            pid_t Pid = fork();
+            if (Pid == 0) {
+                close(Listener);
+                signal(SIGCHLD, SIG_DFL);
+                _exit(handle(Conn, Images, Salt));
+            }
+            if (Pid < 0)
+                minilog::log_error("fork failed: {}", strerror(errno));
+            close(Conn);
+        }
+    }
+
+    int RunClient(const std::string &Socket, const std::string &Source) {
+        std::ifstream In(Source, std::ios::binary);
+        if (!In) {
+            minilog::log_error("can not read {}", Source);
+            return 1;
+        }
+        std::stringstream Text;
+        Text << In.rdbuf();
+        std::string Code = Text.str();
+
+        sockaddr_un Addr;
+        if (!socketAddress(Socket, Addr))
+            return 1;
+        int Conn = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (Conn < 0 || connect(Conn, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) != 0) {
+            minilog::log_error("can not connect to {}: {}", Socket, strerror(errno));
+            return 1;
+        }
+        Header H{static_cast<uint32_t>(Source.size()), static_cast<uint32_t>(Code.size())};
+        int32_t Status = 1;
+        if (!sendHeader(Conn, H) || !writeAll(Conn, Source.data(), Source.size()) ||
+            !writeAll(Conn, Code.data(), Code.size()) || !readAll(Conn, &Status, sizeof(Status))) {
+            minilog::log_error("the server on {} did not answer", Socket);
+            Status = 1;
+        }
+        close(Conn);
+        return Status;
+    }
+#endif
+}
@@ -0,0 +1,161 @@
+//
+// Created by delta on 19/10/2026.
+//
+#include "utils/options.h"
+#include "utils/minilog.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <string_view>
+
+namespace dust{
+    thread_local Options Opts;
+    
+    // Returns false (after printing the problem) if Arg, the value of Option,
+    // is not a number that fits Value.
+    template<typename T>
+    static bool parseNumber(std::string_view Option, const char *Arg, T &Value) {
+        if (llvm::StringRef(Arg).getAsInteger(10, Value)) {
+            minilog::log_error("{} expects a number, got {}", Option, Arg);
+            return false;
+        }
+        return true;
+    }
+    
+    bool ParseOptions(int argc, char **argv) {
+        for (int i = 1; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            if (arg == "--specialize") {
+                Opts.Specialize = true;
+            } else if (arg == "-q" || arg == "--quiet") {
+                Opts.Echo = false;
+            } else if (arg == "--lazy") {
+                Opts.Lazy = true;
+            } else if (arg == "--tiered") {
+                Opts.Tiered = true;
+            } else if (arg == "--interp") {
+                Opts.Interp = true;
+            } else if (arg == "--tier-threshold" && i + 1 < argc) {
+                if (!parseNumber(arg, argv[++i], Opts.TierThreshold))
+                    return false;
+            } else if (arg == "--profile-generate" && i + 1 < argc) {
+                Opts.ProfileGenerate = argv[++i];
+            } else if (arg == "--profile-use" && i + 1 < argc) {
+                Opts.ProfileUse = argv[++i];
+            } else if (arg == "--jitlink") {
+                Opts.JITLink = true;
+            } else if (arg == "--huge-pages") {
+                Opts.HugePages = true;
+            } else if (arg == "--mem-stats") {
+                Opts.MemStats = true;
+            } else if (arg == "--latency") {
+                Opts.Latency = true;
+            } else if (arg == "--cache-dir" && i + 1 < argc) {
+                Opts.CacheDir = argv[++i];
+            } else if (arg == "--cache-size" && i + 1 < argc) {
+                // in megabytes
+                uint64_t MB = 0;
+                if (!parseNumber(arg, argv[++i], MB) || MB > (UINT64_MAX >> 20)) {
+                    minilog::log_error("invalid --cache-size {}", argv[i]);
+                    return false;
+                }
+                Opts.CacheSize = MB << 20;
+            } else if (arg == "-c") {
+                Opts.Output = Options::OutputKind::Object;
+            } else if (arg == "--shared") {
+                Opts.Output = Options::OutputKind::Shared;
+            } else if (arg == "--exe") {
+                Opts.Output = Options::OutputKind::Executable;
+            } else if (arg == "--snapshot" && i + 1 < argc) {
+                Opts.Output = Options::OutputKind::Snapshot;
+                Opts.OutputPath = argv[++i];
+            } else if (arg == "--load" && i + 1 < argc) {
+                Opts.LoadImage = argv[++i];
+            } else if (arg == "--workers" && i + 1 < argc) {
+                if (!parseNumber(arg, argv[++i], Opts.Workers))
+                    return false;
+            } else if (arg == "--timeout" && i + 1 < argc) {
+                if (!parseNumber(arg, argv[++i], Opts.Timeout))
+                    return false;
+            } else if (arg == "--serve" && i + 1 < argc) {
+                Opts.ServeSocket = argv[++i];
+            } else if (arg == "--client" && i + 1 < argc) {
+                Opts.ClientSocket = argv[++i];
+            } else if (arg == "--executor" && i + 2 < argc) {
+                if (!parseNumber(arg, argv[++i], Opts.WorkerIn) || !parseNumber(arg, argv[++i], Opts.WorkerOut))
+                    return false;
+            } else if (arg == "-o" && i + 1 < argc) {
+                Opts.OutputPath = argv[++i];
+            } else if (arg.starts_with("-")) {
+                minilog::log_error("unknown option: {}", arg);
+                return false;
+            } else if (Opts.Source.empty()) {
+                Opts.Source = arg;
+            } else {
+                Opts.Scripts.emplace_back(arg);
+            }
+        }
+        if (Opts.HugePages && Opts.JITLink) {
+            minilog::log_error("--huge-pages only applies to RuntimeDyld, not with --jitlink");
+            return false;
+        }
+        if (Opts.Tiered && Opts.Lazy) {
+            minilog::log_error("--tiered and --lazy can not be combined");
+            return false;
+        }
+        // Interpreted fns are reached through their stub, there are none in lazy mode.
+        if (Opts.Interp && (Opts.Lazy || Opts.Output != Options::OutputKind::JIT)) {
+            minilog::log_error("--interp only works when running in the JIT, without --lazy");
+            return false;
+        }
+        if (!Opts.ProfileGenerate.empty() && !Opts.ProfileUse.empty()) {
+            minilog::log_error("--profile-generate and --profile-use can not be combined");
+            return false;
+        }
+        // A snapshot runs in the JIT, whose own counters go to the same file.
+        if (!Opts.ProfileGenerate.empty() && Opts.Output == Options::OutputKind::Snapshot) {
+            minilog::log_error("--profile-generate can not be combined with --snapshot");
+            return false;
+        }
+        // The image is linked into the JIT, its code must be compiled the same way.
+        if (!Opts.LoadImage.empty() && (Opts.Lazy || Opts.Output != Options::OutputKind::JIT)) {
+            minilog::log_error("--load only works when running in the JIT, without --lazy");
+            return false;
+        }
+        if (Opts.Output == Options::OutputKind::Snapshot && Opts.Lazy) {
+            minilog::log_error("--snapshot can not be combined with --lazy");
+            return false;
+        }
+        if (!Opts.Scripts.empty() && !Opts.Workers) {
+            minilog::log_error("more than one source file needs --workers");
+            return false;
+        }
+        // Workers run what is linked into them and call only their own runtime,
+        // not back into this process: no hooks, counters or stats of ours.
+        if (Opts.Workers && (Opts.Lazy || Opts.Tiered || Opts.Interp || !Opts.ProfileGenerate.empty() ||
+                             Opts.HugePages || Opts.MemStats || Opts.Output != Options::OutputKind::JIT ||
+                             Opts.Source.empty())) {
+            minilog::log_error("--workers runs source files in the JIT, without --lazy, --tiered, --interp, "
+                               "--profile-generate, --huge-pages or --mem-stats");
+            return false;
+        }
+        if (Opts.Timeout && !Opts.Workers) {
+            minilog::log_error("--timeout only applies to scripts run with --workers");
+            return false;
+        }
+        // Scripts are compiled into snapshots, which lazy mode has none of.
+        if (!Opts.ServeSocket.empty() && (Opts.Lazy || Opts.Workers || !Opts.Source.empty() ||
+                                          Opts.Output != Options::OutputKind::JIT)) {
+            minilog::log_error("--serve takes its scripts from clients, without --lazy or --workers");
+            return false;
+        }
+        if (!Opts.ClientSocket.empty() && (Opts.Source.empty() || !Opts.Scripts.empty())) {
+            minilog::log_error("--client needs one source file to run");
+            return false;
+        }
+        if (Opts.Output != Options::OutputKind::JIT && Opts.Source.empty()) {
+            minilog::log_error("no source file to compile");
+            return false;
+        }
+        return true;
+    }
+}
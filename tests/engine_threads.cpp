@@ -0,0 +1,87 @@
+//
+// Created by delta on 19/10/2026.
+//
+// 32 engines on 32 threads at once, each compiling fns of the same names with
+// bodies of its own and calling them. An engine seeing another's definitions,
+// or state torn by a neighbour, shows up as a wrong result.
+#include "engine/engine.h"
+#include <atomic>
+#include <cstdio>
+#include <format>
+#include <latch>
+#include <thread>
+#include <vector>
+
+using namespace dust;
+
+static constexpr int Threads = 32;
+// Engines per thread, one after the other, each on the state the last left.
+static constexpr int Rounds = 3;
+
+static bool check(int Id, int Round, const char *What, double Got, double Want) {
+    if (Got == Want)
+        return true;
+    fprintf(stderr, "thread %d, round %d: %s is %g, not %g\n", Id, Round, What, Got, Want);
+    return false;
+}
+
+static bool runEngine(int Id, int Round) {
+    auto E = Engine::Create();
+    if (!E) {
+        fprintf(stderr, "thread %d, round %d: no engine\n", Id, Round);
+        return false;
+    }
+    int K = Id * Rounds + Round;
+    if (!E->compile(std::format("const k:num={};\n"
+                                "fn calc(a:num,b:num):num{{ return a*b+k; }}\n"
+                                "fn sum(n:num):num{{ if n<1 {{ return 0; }} return n+sum(n-1); }}\n"
+                                "fn only{}(a:num):num{{ return a+{}; }}\n",
+                                K, Id, Id))) {
+        fprintf(stderr, "thread %d, round %d: compile failed\n", Id, Round);
+        return false;
+    }
+    auto *Calc = E->get<double(double, double)>("calc");
+    auto *Sum = E->get<double(double)>("sum");
+    auto *Only = E->get<double(double)>(std::format("only{}", Id));
+    if (!Calc || !Sum || !Only) {
+        fprintf(stderr, "thread %d, round %d: fn missing\n", Id, Round);
+        return false;
+    }
+    // Another thread's fn is not defined here.
+    if (E->get<double(double)>(std::format("only{}", (Id + 1) % Threads))) {
+        fprintf(stderr, "thread %d, round %d: sees the fns of another engine\n", Id, Round);
+        return false;
+    }
+    bool Ok = check(Id, Round, "calc(2, 3)", Calc(2, 3), 6 + K) &&
+              check(Id, Round, "sum(Id)", Sum(Id), Id * (Id + 1) / 2) &&
+              check(Id, Round, "only(1)", Only(1), 1 + Id);
+    if (!Ok)
+        return false;
+    // The pointer follows the redefinition.
+    if (!E->compile("fn calc(a:num,b:num):num{ return a*b-k; }")) {
+        fprintf(stderr, "thread %d, round %d: redefinition failed\n", Id, Round);
+        return false;
+    }
+    return check(Id, Round, "redefined calc(2, 3)", Calc(2, 3), 6 - K);
+}
+
+int main() {
+    std::atomic<int> Failed = 0;
+    std::latch Start(Threads);
+    std::vector<std::thread> Workers;
+    for (int Id = 0; Id < Threads; ++Id) {
+        Workers.emplace_back([&, Id] {
+            // All engines are created and compiling at the same time.
+            Start.arrive_and_wait();
+            for (int Round = 0; Round < Rounds; ++Round) {
+                if (!runEngine(Id, Round))
+                    ++Failed;
+            }
+        });
+    }
+    for (auto &T: Workers)
+        T.join();
+    if (Failed)
+        fprintf(stderr, "%d of %d engines failed\n", Failed.load(), Threads * Rounds);
+    return Failed ? 1 : 0;
+}